@@ -6,6 +6,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/operations.hpp>
 
 #include "../src/camera_fitting.h"
 #include "../pba/nvmio.h"
@@ -14,23 +15,352 @@ using namespace vw;
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
+// 64 bit FNV-1a
+uint64 fnv1a( char const* data, size_t size,
+              uint64 hash = 14695981039346656037ULL ) {
+  for ( size_t i = 0; i < size; i++ ) {
+    hash ^= uint8( data[i] );
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+uint64 fnv1a( std::string const& data, uint64 hash ) {
+  return fnv1a( data.data(), data.size(), hash );
+}
+
+// Identifies what a linearization was made from: the cube's name, size
+// and modification time, the grid settings and, for an adjusted
+// camera, the contents of the adjust file.
+uint64 camera_hash( std::string const& entry, std::string const& cube,
+                    int grid_size, double grid_tolerance ) {
+  std::ostringstream key;
+  key << "isis_cnet_to_nvm 2 " << grid_size << " " << grid_tolerance << " " << cube << " "
+      << fs::file_size( cube ) << " " << fs::last_write_time( cube );
+  uint64 hash = fnv1a( key.str(), 14695981039346656037ULL );
+  if ( entry != cube ) {
+    std::ifstream adjust( entry.c_str(), std::ios::in | std::ios::binary );
+    std::ostringstream contents;
+    contents << adjust.rdbuf();
+    hash = fnv1a( contents.str(), hash );
+  }
+  return hash;
+}
+
+// Where measurements land in the linearized camera, sampled on a grid
+// of ISIS pixels and bilinearly interpolated in between. Only used
+// when asked for with --grid-size; empty otherwise.
+struct ConversionGrid {
+  int32 cols, rows;
+  double spacing_x, spacing_y;
+  std::vector<Vector2> values;
+
+  ConversionGrid() : cols(0), rows(0), spacing_x(0), spacing_y(0) {}
+
+  Vector2 node( int32 i, int32 j ) const { return Vector2( i * spacing_x, j * spacing_y ); }
+
+  Vector2 operator()( Vector2 const& px ) const {
+    double gx = px[0] / spacing_x, gy = px[1] / spacing_y;
+    int32 i = std::min( std::max( int32( floor( gx ) ), 0 ), cols - 2 );
+    int32 j = std::min( std::max( int32( floor( gy ) ), 0 ), rows - 2 );
+    double tx = gx - i, ty = gy - j;
+    Vector2 const* row0 = &values[j * cols + i];
+    Vector2 const* row1 = row0 + cols;
+    return ( 1 - ty ) * ( ( 1 - tx ) * row0[0] + tx * row0[1] ) +
+      ty * ( ( 1 - tx ) * row1[0] + tx * row1[1] );
+  }
+};
+
 struct CameraInfo {
-  CameraInfo( std::string const& f,
-              camera::CameraModel* i,
-              camera::PinholeModel const& p ) :
-    filename(f), isis_model(i), model(p) {}
   std::string filename;
-  boost::shared_ptr<camera::CameraModel> isis_model; // for copy
   camera::PinholeModel model;
+  ConversionGrid grid;
+  boost::shared_ptr<camera::CameraModel> isis_model; // Set when converting exactly
+  std::string error; // Set by a failed task, thrown once the queue is done
+};
+
+// Opens the ISIS camera for a cube list entry. Callers must hold the
+// ISIS mutex.
+camera::CameraModel* load_isis_camera( std::string const& entry, Vector2i& size ) {
+  if ( fs::extension( entry ) == ".isis_adjust" ) {
+    typedef boost::shared_ptr<asp::BaseEquation> EqnPtr;
+    std::ifstream input( entry.c_str() );
+    EqnPtr posF  = asp::read_equation(input);
+    EqnPtr poseF = asp::read_equation(input);
+    input.close();
+    camera::IsisAdjustCameraModel* camera =
+      new camera::IsisAdjustCameraModel( fs::change_extension( entry, ".cub" ).string(),
+                                         posF, poseF );
+    size = Vector2i( camera->samples(), camera->lines() );
+    return camera;
+  }
+  camera::IsisCameraModel* camera = new camera::IsisCameraModel( entry );
+  size = Vector2i( camera->samples(), camera->lines() );
+  return camera;
+}
+
+void write_camera_cache( std::string const& file, uint64 hash,
+                         CameraInfo const& info ) {
+  std::ostringstream tmp_stream;
+  tmp_stream << file << ".tmp." << getpid();
+  std::string tmp = tmp_stream.str();
+  {
+    std::ofstream out( tmp.c_str() );
+    if ( !out.is_open() )
+      vw_throw( IOErr() << "Unable to write cache: " << tmp );
+    out << std::setprecision(17);
+    out << "LINEAR_PINHOLE_CACHE " << hash << "\n";
+    Vector3 center = info.model.camera_center();
+    Matrix3x3 rotation = info.model.camera_pose().rotation_matrix();
+    out << center[0] << " " << center[1] << " " << center[2] << "\n";
+    for ( size_t i = 0; i < 3; i++ )
+      out << rotation(i,0) << " " << rotation(i,1) << " " << rotation(i,2) << "\n";
+    out << info.model.focal_length()[0] << " " << info.model.focal_length()[1] << " "
+        << info.model.point_offset()[0] << " " << info.model.point_offset()[1] << "\n";
+    out << info.grid.cols << " " << info.grid.rows << " "
+        << info.grid.spacing_x << " " << info.grid.spacing_y << "\n";
+    BOOST_FOREACH( Vector2 const& value, info.grid.values )
+      out << value[0] << " " << value[1] << "\n";
+    if ( !out )
+      vw_throw( IOErr() << "Failed writing cache: " << tmp );
+  }
+  // boost's v2 rename refuses to replace a stale cache, POSIX's doesn't
+  if ( std::rename( tmp.c_str(), file.c_str() ) != 0 ) {
+    unlink( tmp.c_str() );
+    vw_throw( IOErr() << "Unable to move " << tmp << " to " << file );
+  }
+}
+
+bool read_camera_cache( std::string const& file, uint64 hash,
+                        CameraInfo& info ) {
+  std::ifstream in( file.c_str() );
+  std::string magic;
+  uint64 file_hash;
+  if ( !( in >> magic >> file_hash ) ||
+       magic != "LINEAR_PINHOLE_CACHE" || file_hash != hash )
+    return false;
+  Vector3 center;
+  Matrix3x3 rotation;
+  Vector2 focal, offset;
+  in >> center[0] >> center[1] >> center[2];
+  for ( size_t i = 0; i < 3; i++ )
+    in >> rotation(i,0) >> rotation(i,1) >> rotation(i,2);
+  in >> focal[0] >> focal[1] >> offset[0] >> offset[1];
+  ConversionGrid& grid = info.grid;
+  in >> grid.cols >> grid.rows >> grid.spacing_x >> grid.spacing_y;
+  if ( !in || grid.cols < 0 || grid.rows < 0 )
+    return false;
+  grid.values.resize( grid.cols * grid.rows );
+  BOOST_FOREACH( Vector2& value, grid.values )
+    in >> value[0] >> value[1];
+  if ( !in )
+    return false;
+  info.model = camera::PinholeModel( center, rotation, focal[0], focal[1],
+                                     offset[0], offset[1],
+                                     Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1),
+                                     camera::NullLensDistortion() );
+  return true;
+}
+
+// Loads one camera: from its cache when that is current, otherwise by
+// sampling ISIS and fitting a pinhole. ISIS is not reentrant, so all
+// ISIS work for a cube happens in one locked section and the fit and
+// conversion grid are computed outside of it.
+//
+// Measurements are converted exactly through ISIS unless a grid size
+// is given. A grid is only kept when its interpolation error at every
+// cell center is within tolerance; otherwise that camera falls back to
+// exact conversion.
+class LinearizeTask : public Task {
+  CameraInfo& m_info;
+  Mutex &m_isis_mutex, &m_output_mutex;
+  bool m_use_cache;
+  int m_grid_size;
+  double m_grid_tolerance;
+
+  void open_isis() {
+    Mutex::Lock lock( m_isis_mutex );
+    Vector2i size;
+    m_info.isis_model.reset( load_isis_camera( m_info.filename, size ) );
+  }
+
+public:
+  LinearizeTask( CameraInfo& info, Mutex& isis_mutex, Mutex& output_mutex,
+                 bool use_cache, int grid_size, double grid_tolerance ) :
+    m_info(info), m_isis_mutex(isis_mutex), m_output_mutex(output_mutex),
+    m_use_cache(use_cache), m_grid_size(grid_size),
+    m_grid_tolerance(grid_tolerance) {}
+
+  virtual ~LinearizeTask() {}
+  virtual void operator()() {
+    try {
+      linearize();
+    } catch ( std::exception const& e ) {
+      m_info.error = m_info.filename + ": " + e.what();
+    }
+  }
+
+private:
+  void linearize() {
+    std::string const& entry = m_info.filename;
+    bool adjusted = fs::extension( entry ) == ".isis_adjust";
+    std::string cube = adjusted ? fs::change_extension( entry, ".cub" ).string() : entry;
+    std::string cache = fs::change_extension( entry, ".linear_pinhole" ).string();
+    uint64 hash = camera_hash( entry, cube, m_grid_size, m_grid_tolerance );
+    if ( m_use_cache && read_camera_cache( cache, hash, m_info ) ) {
+      // A cached camera without a grid still needs ISIS for its measures
+      if ( m_info.grid.values.empty() )
+        open_isis();
+      Mutex::Lock lock( m_output_mutex );
+      std::cout << "\t\"" << entry << "\" (cached)\n";
+      return;
+    }
+
+    PinholeFitSamples samples;
+    ConversionGrid& grid = m_info.grid;
+    grid.cols = grid.rows = 0;
+    grid.values.clear();
+    std::vector<Vector3> grid_points, check_points;
+    std::vector<Vector2> check_pixels;
+    {
+      Mutex::Lock lock( m_isis_mutex );
+      Vector2i size;
+      m_info.isis_model.reset( load_isis_camera( entry, size ) );
+      camera::CameraModel* camera = m_info.isis_model.get();
+      samples = sample_pinhole_fit( camera, size );
+
+      if ( m_grid_size > 0 ) {
+        grid.cols = grid.rows = std::max( 2, m_grid_size );
+        grid.spacing_x = double(size[0]-1) / double(grid.cols-1);
+        grid.spacing_y = double(size[1]-1) / double(grid.rows-1);
+        grid_points.reserve( grid.cols * grid.rows );
+        for ( int32 j = 0; j < grid.rows; j++ )
+          for ( int32 i = 0; i < grid.cols; i++ ) {
+            Vector2 px = grid.node( i, j );
+            grid_points.push_back( camera->camera_center( px ) +
+                                   camera->pixel_to_vector( px ) );
+          }
+
+        // Every cell center, where bilinear interpolation is worst
+        for ( int32 j = 0; j + 1 < grid.rows; j++ )
+          for ( int32 i = 0; i + 1 < grid.cols; i++ ) {
+            Vector2 px = grid.node( i, j ) + Vector2( grid.spacing_x, grid.spacing_y ) / 2;
+            check_pixels.push_back( px );
+            check_points.push_back( camera->camera_center( px ) +
+                                    camera->pixel_to_vector( px ) );
+          }
+      }
+    }
+
+    int status;
+    double error;
+    m_info.model = fit_pinhole( samples, status, error );
+
+    // Enforcing that the focal lengths are equal (NVM requires it)
+    Vector2 focal = m_info.model.focal_length();
+    m_info.model.set_focal_length( Vector2(focal[0],focal[0]) );
+
+    double grid_error = 0;
+    if ( !grid_points.empty() ) {
+      grid.values.resize( grid_points.size() );
+      for ( size_t i = 0; i < grid_points.size(); i++ )
+        grid.values[i] = m_info.model.point_to_pixel( grid_points[i] ) -
+          m_info.model.point_offset();
+      for ( size_t i = 0; i < check_points.size(); i++ )
+        grid_error = std::max( grid_error,
+                               norm_2( grid( check_pixels[i] ) -
+                                       ( m_info.model.point_to_pixel( check_points[i] ) -
+                                         m_info.model.point_offset() ) ) );
+      if ( grid_error > m_grid_tolerance ) {
+        grid.cols = grid.rows = 0;
+        grid.values.clear();
+      } else {
+        // The grid stands in for ISIS from here on
+        Mutex::Lock lock( m_isis_mutex );
+        m_info.isis_model.reset();
+      }
+    }
+
+    if ( m_use_cache ) {
+      try {
+        write_camera_cache( cache, hash, m_info );
+      } catch ( Exception const& e ) {
+        vw_out(WarningMessage) << "Unable to cache linearized camera: " << e.what() << "\n";
+      } catch ( std::exception const& e ) {
+        vw_out(WarningMessage) << "Unable to cache linearized camera: " << e.what() << "\n";
+      }
+    }
+
+    Mutex::Lock lock( m_output_mutex );
+    std::cout << "\t\"" << entry << "\"\n";
+    std::cout << "Status  : " << status << "\n";
+    std::cout << "Error   : " << error << "\n";
+    if ( !grid_points.empty() )
+      std::cout << "Grid err: " << grid_error << " px"
+                << ( grid.values.empty() ? " (over tolerance, converting exactly)" : "" )
+                << "\n";
+  }
+};
+
+// Moves the measures seen by one camera into its linearized frame.
+// Exact conversion gathers the ISIS rays for all of the camera's
+// measures in one locked section and projects them outside of it.
+class ConvertMeasuresTask : public Task {
+  CameraInfo& m_info;
+  std::vector<ba::ControlMeasure*> const& m_measures;
+  Mutex& m_isis_mutex;
+public:
+  ConvertMeasuresTask( CameraInfo& info,
+                       std::vector<ba::ControlMeasure*> const& measures,
+                       Mutex& isis_mutex ) :
+    m_info(info), m_measures(measures), m_isis_mutex(isis_mutex) {}
+  virtual ~ConvertMeasuresTask() {}
+  virtual void operator()() {
+    try {
+      convert();
+    } catch ( std::exception const& e ) {
+      m_info.error = m_info.filename + ": " + e.what();
+    }
+  }
+
+private:
+  void convert() {
+    if ( !m_info.grid.values.empty() ) {
+      BOOST_FOREACH( ba::ControlMeasure* cm, m_measures )
+        cm->set_position( m_info.grid( cm->position() ) );
+      return;
+    }
+
+    std::vector<Vector3> points( m_measures.size() );
+    {
+      Mutex::Lock lock( m_isis_mutex );
+      for ( size_t i = 0; i < m_measures.size(); i++ ) {
+        Vector2 ipx = m_measures[i]->position();
+        points[i] = m_info.isis_model->camera_center(ipx) +
+          m_info.isis_model->pixel_to_vector(ipx);
+      }
+    }
+    for ( size_t i = 0; i < m_measures.size(); i++ )
+      m_measures[i]->set_position( m_info.model.point_to_pixel( points[i] ) -
+                                   m_info.model.point_offset() );
+  }
 };
 
 int main( int argc, char* argv[] ) {
 
   std::string cube_list_file, cnet_file;
+  int num_threads, grid_size;
+  double grid_tolerance;
   po::options_description general_options("Options");
   general_options.add_options()
     ("cube-list", po::value(&cube_list_file), "A file listing the input cube files.")
     ("cnet-file", po::value(&cnet_file), "Input control network.")
+    ("threads,t", po::value(&num_threads)->default_value(vw_settings().default_num_threads()),
+     "Number of threads to use.")
+    ("grid-size", po::value(&grid_size)->default_value(0),
+     "Interpolate measurements from a grid of this many ISIS samples per side instead of converting each one through ISIS. 0 converts exactly.")
+    ("grid-tolerance", po::value(&grid_tolerance)->default_value(0.01),
+     "Largest interpolation error in pixels a grid may have. Cameras over it are converted exactly.")
+    ("no-cache", "Don't read or write the .linear_pinhole cache next to each camera.")
     ("help,h", "Display this help message");
 
   po::positional_options_description p;
@@ -53,62 +383,44 @@ int main( int argc, char* argv[] ) {
     vw_out() << "\n" << usage.str() << "\n";
     return 1;
   }
-
-  std::vector<CameraInfo> camera_information;
-  std::vector<camera::PinholeModel*> camera_ptrs;
+  if ( num_threads < 1 )
+    num_threads = 1;
+  if ( grid_size < 0 )
+    grid_size = 0;
 
   // Opening Camera List
-  std::cout << "Loading cameras:\n";
+  std::vector<CameraInfo> camera_information;
   std::ifstream camlist( cube_list_file.c_str(), std::ifstream::in );
   if ( !camlist.is_open() )
     vw_throw( ArgumentErr() << "Unable to open \"" << cube_list_file << "\"." );
   std::string cam_buffer;
   std::getline( camlist, cam_buffer );
   while ( !camlist.eof() ) {
-    std::cout << "\t\"" << cam_buffer << "\"\n";
-
-    camera::PinholeModel pin;
-    camera::CameraModel* isis_model;
-    if ( fs::extension( cam_buffer ) == ".isis_adjust" ) {
-      typedef boost::shared_ptr<asp::BaseEquation> EqnPtr;
-      std::ifstream input( cam_buffer.c_str() );
-      EqnPtr posF  = asp::read_equation(input);
-      EqnPtr poseF = asp::read_equation(input);
-      input.close();
-      camera::IsisAdjustCameraModel* camera =
-        new camera::IsisAdjustCameraModel( fs::change_extension( cam_buffer,
-                                                                 ".cub" ).string(),
-                                           posF, poseF );
-      isis_model = camera;
-      pin =
-        linearize_pinhole(camera,
-                          Vector2i(camera->samples(),
-                                   camera->lines()) );
-    } else {
-      // Load up camera model and convert
-      camera::IsisCameraModel* camera =
-        new camera::IsisCameraModel( cam_buffer );
-      isis_model = camera;
-      pin =
-        linearize_pinhole(camera,
-                          Vector2i(camera->samples(),
-                                   camera->lines()) );
-    }
-
-    // Enforcing that the focal lengths are equal (NVM requires it)
-    Vector2 focal = pin.focal_length();
-    pin.set_focal_length( Vector2(focal[0],focal[0]) );
-
-    // Save and record
-    camera_information.push_back( CameraInfo( cam_buffer, isis_model,
-                                              pin ) );
-
+    camera_information.push_back( CameraInfo() );
+    camera_information.back().filename = cam_buffer;
     std::getline( camlist, cam_buffer );
   }
   camlist.close();
 
+  // Loading and linearizing cameras
+  std::cout << "Loading cameras:\n";
+  Mutex isis_mutex;
+  {
+    Mutex output_mutex;
+    FifoWorkQueue queue( num_threads );
+    BOOST_FOREACH( CameraInfo& info, camera_information )
+      queue.add_task( boost::shared_ptr<Task>(
+          new LinearizeTask( info, isis_mutex, output_mutex,
+                             !vm.count("no-cache"), grid_size,
+                             grid_tolerance ) ) );
+    queue.join_all();
+  }
+  BOOST_FOREACH( CameraInfo const& info, camera_information )
+    if ( !info.error.empty() )
+      vw_throw( IOErr() << "Failed to load camera " << info.error << "\n" );
+
   // Pull out the pointers
-  camera_ptrs.resize( camera_information.size() );
+  std::vector<camera::PinholeModel*> camera_ptrs( camera_information.size() );
   for( size_t i = 0; i < camera_information.size(); i++ )
     camera_ptrs[i] = &camera_information[i].model;
 
@@ -116,16 +428,23 @@ int main( int argc, char* argv[] ) {
   ba::ControlNetwork cnet("nvm");
   cnet.read_binary( cnet_file );
 
-  // Converting control network to simplified control network
-  BOOST_FOREACH( ba::ControlPoint& cp, cnet ) {
-    BOOST_FOREACH( ba::ControlMeasure& cm, cp ) {
-      CameraInfo* cam = &camera_information[cm.image_id()];
-      Vector2 ipx = cm.position();
-      cm.set_position( cam->model.point_to_pixel(cam->isis_model->camera_center(ipx) +
-                                                 cam->isis_model->pixel_to_vector(ipx)) -
-                       cam->model.point_offset() );
-    }
+  // Converting control network to simplified control network, one
+  // task per camera
+  {
+    std::vector<std::vector<ba::ControlMeasure*> > measures( camera_information.size() );
+    BOOST_FOREACH( ba::ControlPoint& cp, cnet )
+      BOOST_FOREACH( ba::ControlMeasure& cm, cp )
+        measures[cm.image_id()].push_back( &cm );
+    FifoWorkQueue queue( num_threads );
+    for ( size_t i = 0; i < camera_information.size(); i++ )
+      queue.add_task( boost::shared_ptr<Task>(
+          new ConvertMeasuresTask( camera_information[i], measures[i],
+                                   isis_mutex ) ) );
+    queue.join_all();
   }
+  BOOST_FOREACH( CameraInfo const& info, camera_information )
+    if ( !info.error.empty() )
+      vw_throw( IOErr() << "Failed to convert measures of " << info.error << "\n" );
 
   // Writing NVM
   write_nvm_iterator_ptr( cnet_file,
@@ -8,12 +8,173 @@ namespace fs = boost::filesystem;
 #include <vw/Math.h>
 #include <vw/InterestPoint/InterestData.h>
 #include <vw/Camera/PinholeModel.h>
-#include <vw/BundleAdjustment/ControlNetworkLoader.h>
+#include <vw/InterestPoint/Matcher.h>
 using namespace vw;
 
 // Stereo Pipeline
 #include <asp/Core/Common.h>
 #include "../pba/nvmio.h"
+#include "../pba/nvm_triangulate.h"
+using vw::ip::InterestPoint;
+#include "../src/iprecord.h"
+#include "../src/ip_tracks.h"
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/file.hpp>
+namespace io = boost::iostreams;
+
+#include <map>
+#include <set>
+
+// Streams matches into tracks. A measure is identified by its
+// ip_key, and gets a dense id plus a feature index within its image
+// the first time it is seen.
+class TrackBuilder {
+  IPKeyIndex m_index;
+  std::vector<uint32> m_image_features;
+
+public:
+  UnionFind sets;
+  std::vector<uint32> image_id, feature_id;
+  std::vector<Vector2f> position;
+
+  TrackBuilder( size_t num_images ) : m_image_features( num_images, 0 ) {}
+
+  uint32 measure( uint32 image, Vector2f const& p ) {
+    uint32 id = m_index.insert( ip_key( image, p[0], p[1] ) );
+    if ( id == image_id.size() ) {
+      image_id.push_back( image );
+      feature_id.push_back( m_image_features[image]++ );
+      position.push_back( p );
+    }
+    return id;
+  }
+
+  // Measure ids of each match, ready to be joined. Grows the sets to
+  // cover any new measures.
+  void link( uint32 left, uint32 right,
+             std::vector<Vector2f> const& left_ip,
+             std::vector<Vector2f> const& right_ip,
+             std::vector<std::pair<uint32,uint32> >& links ) {
+    links.resize( left_ip.size() );
+    for ( size_t i = 0; i < left_ip.size(); i++ )
+      links[i] = std::make_pair( measure( left, left_ip[i] ),
+                                 measure( right, right_ip[i] ) );
+    sets.resize( image_id.size() );
+  }
+
+  size_t size() const { return image_id.size(); }
+};
+
+class JoinTask : public Task {
+  UnionFind& m_sets;
+  std::vector<std::pair<uint32,uint32> > const& m_links;
+public:
+  JoinTask( UnionFind& sets, std::vector<std::pair<uint32,uint32> > const& links ) :
+    m_sets(sets), m_links(links) {}
+  virtual ~JoinTask() {}
+  virtual void operator()() {
+    for ( size_t i = 0; i < m_links.size(); i++ )
+      m_sets.join( m_links[i].first, m_links[i].second );
+  }
+};
+
+// Key of an image for the match files in its directory. Inputs and
+// directory listings both go through this, so "a.nvm" and "./a.nvm"
+// agree.
+std::string image_key( std::string const& directory, std::string const& stem ) {
+  return ( fs::path( directory.empty() ? "." : directory ) / stem ).string();
+}
+
+// A match file between two of the input images
+struct MatchPair {
+  uint32 left, right;
+  std::string file;
+  std::vector<Vector2f> left_ip, right_ip;
+  std::vector<std::pair<uint32,uint32> > links;
+  std::string error; // Set by a failed read, reported by the merge
+};
+
+class MatchReadTask : public Task {
+  MatchPair& m_pair;
+public:
+  MatchReadTask( MatchPair& pair ) : m_pair(pair) {}
+  virtual ~MatchReadTask() {}
+  virtual void operator()() {
+    std::vector<ip::InterestPoint> ip1, ip2;
+    try {
+      ip::read_binary_match_file( m_pair.file, ip1, ip2 );
+    } catch ( std::exception const& e ) {
+      // Also bad_alloc and filesystem errors, which would otherwise
+      // end the process on this thread
+      m_pair.error = m_pair.file + ": " + e.what();
+      return;
+    }
+    if ( ip1.size() != ip2.size() ) {
+      std::ostringstream error;
+      error << "Corrupt match file " << m_pair.file << ": " << ip1.size()
+            << " left and " << ip2.size() << " right matches";
+      m_pair.error = error.str();
+      return;
+    }
+    m_pair.left_ip.resize( ip1.size() );
+    m_pair.right_ip.resize( ip2.size() );
+    for ( size_t i = 0; i < ip1.size(); i++ ) {
+      m_pair.left_ip[i] = Vector2f( ip1[i].x, ip1[i].y );
+      m_pair.right_ip[i] = Vector2f( ip2[i].x, ip2[i].y );
+    }
+  }
+};
+
+// Triangulates tracks [m_begin,m_end). Tracks that see an image twice
+// or cannot be triangulated are marked invalid.
+class TrackTriangulateTask : public Task {
+  std::vector<NVMProjector> const& m_cameras;
+  TrackBuilder const& m_builder;
+  std::vector<uint32> const& m_offsets, & m_members;
+  size_t m_begin, m_end;
+  std::vector<Vector3>& m_positions;
+  std::vector<char>& m_valid;
+
+public:
+  TrackTriangulateTask( std::vector<NVMProjector> const& cameras,
+                        TrackBuilder const& builder,
+                        std::vector<uint32> const& offsets,
+                        std::vector<uint32> const& members,
+                        size_t begin, size_t end,
+                        std::vector<Vector3>& positions,
+                        std::vector<char>& valid ) :
+    m_cameras(cameras), m_builder(builder), m_offsets(offsets),
+    m_members(members), m_begin(begin), m_end(end), m_positions(positions),
+    m_valid(valid) {}
+
+  virtual ~TrackTriangulateTask() {}
+  virtual void operator()() {
+    ba::ControlPoint cp;
+    for ( size_t t = m_begin; t < m_end; t++ ) {
+      cp.resize( m_offsets[t+1] - m_offsets[t] );
+      bool valid = cp.size() >= 2;
+      for ( size_t i = 0; i < cp.size() && valid; i++ ) {
+        uint32 m = m_members[m_offsets[t] + i];
+        Vector2f const& p = m_builder.position[m];
+        cp[i] = ba::ControlMeasure( p[0], p[1], 1, 1, m_builder.image_id[m] );
+        for ( size_t j = 0; j < i; j++ )
+          if ( cp[j].image_id() == cp[i].image_id() )
+            valid = false;
+      }
+      Vector3 position;
+      if ( valid && triangulate_midpoint( m_cameras, cp, position ) ) {
+        cp.set_position( position );
+        refine_point( m_cameras, cp, 20, false );
+        m_positions[t] = cp.position();
+      } else {
+        valid = false;
+      }
+      m_valid[t] = valid;
+    }
+  }
+};
 
 struct Options : public asp::BaseOptions {
   std::vector<std::string> input_names;
@@ -22,6 +183,7 @@ struct Options : public asp::BaseOptions {
   std::vector<float>       focal_lengths;
   int32 min_matches;
 
+  std::vector<std::string> bulk_matches;
   std::string nvm_output;
 };
 
@@ -30,7 +192,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   general_options.add_options()
     ("o,output-nvm", po::value(&opt.nvm_output)->default_value("built"),
      "Output name for NVM file.")
-    ("min-matches", po::value(&opt.min_matches)->default_value(5));
+    ("min-matches", po::value(&opt.min_matches)->default_value(5))
+    ("bulk-match", po::value(&opt.bulk_matches),
+     "Packed match file from apollo_bulk_match to read instead of .match files. Can be repeated.");
   general_options.add( asp::BaseOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -80,36 +244,226 @@ int main( int argc, char* argv[] ) {
       index++;
     }
 
-    // Construct Pinhole Camera Models
-    std::vector< boost::shared_ptr<camera::CameraModel> > camera_models;
-    {
-      TerminalProgressCallback tpc("","Building Models:");
+    std::vector<NVMBinaryCamera> cameras( opt.input_names.size() );
+    std::vector<NVMProjector> projectors;
+    std::map<std::string, uint32> prefix_index, stem_index;
+    std::set<std::string> directories, shared_stems;
+    for ( size_t i = 0; i < opt.input_names.size(); i++ ) {
+      cameras[i].focal = opt.focal_lengths[i];
+      for ( size_t r = 0; r < 3; r++ ) {
+        for ( size_t c = 0; c < 3; c++ )
+          cameras[i].rotation[3*r+c] = opt.rotations[i](r,c);
+        cameras[i].translation[r] = opt.translations[i][r];
+      }
+      projectors.push_back( NVMProjector( cameras[i] ) );
+
+      fs::path path( opt.input_names[i] );
+      std::string directory = path.has_parent_path() ? path.parent_path().string() : ".";
+      prefix_index[ image_key( directory, path.stem() ) ] = i;
+      if ( !stem_index.insert( std::make_pair( path.stem(), uint32(i) ) ).second )
+        shared_stems.insert( path.stem() );
+      directories.insert( directory );
+    }
+
+    // Image pair index. One directory listing replaces testing every
+    // possible pair's match file for existence.
+    TrackBuilder builder( opt.input_names.size() );
+    size_t num_pairs = 0;
+    int num_threads = std::max( 1, vw_settings().default_num_threads() );
+    if ( opt.bulk_matches.empty() ) {
+      std::vector<MatchPair> pairs;
+      BOOST_FOREACH( std::string const& directory, directories ) {
+        for ( fs::directory_iterator it( directory ), end; it != end; it++ ) {
+          std::string name = it->path().filename();
+          size_t split = name.find("__");
+          if ( split == std::string::npos || fs::extension( name ) != ".match" )
+            continue;
+          std::string left = image_key( directory, name.substr( 0, split ) );
+          std::string right = fs::basename( name.substr( split + 2 ) );
+          if ( !prefix_index.count( left ) || !stem_index.count( right ) )
+            continue;
+          // The right side is only a stem. Prefer the input in the
+          // match file's own directory, and never guess between inputs
+          // in different directories that share it.
+          uint32 right_index;
+          if ( prefix_index.count( image_key( directory, right ) ) )
+            right_index = prefix_index[ image_key( directory, right ) ];
+          else if ( shared_stems.count( right ) )
+            vw_throw( ArgumentErr() << "Unable to tell which input \"" << right
+                      << "\" in " << it->path().string() << " refers to, "
+                      << "several inputs share that name.\n" );
+          else
+            right_index = stem_index[right];
+          pairs.push_back( MatchPair() );
+          pairs.back().left = prefix_index[left];
+          pairs.back().right = right_index;
+          pairs.back().file = it->path().string();
+        }
+      }
+      std::cout << "Found match files: " << pairs.size() << "\n";
+
+      // Files are read a batch at a time on threads and merged in order
+      TerminalProgressCallback tpc("","Reading Matches:");
       tpc.report_progress(0);
-      float inc_amt = 1.0/float(opt.input_names.size());
-      for ( size_t i = 0; i < opt.input_names.size(); i++ ) {
-        tpc.report_incremental_progress(inc_amt);
-        Vector3f camera_center =
-          -transpose(opt.rotations[i])*opt.translations[i];
-        camera_models.push_back( boost::shared_ptr<camera::CameraModel>(
-          new camera::PinholeModel( camera_center, transpose(opt.rotations[i]),
-                                    opt.focal_lengths[i], opt.focal_lengths[i], 0, 0,
-                                    Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1),
-                                    camera::NullLensDistortion() ) ) );
+      size_t batch = 8 * num_threads;
+      for ( size_t start = 0; start < pairs.size(); start += batch ) {
+        size_t stop = std::min( start + batch, pairs.size() );
+        {
+          FifoWorkQueue queue( num_threads );
+          for ( size_t i = start; i < stop; i++ )
+            queue.add_task( boost::shared_ptr<Task>( new MatchReadTask( pairs[i] ) ) );
+          queue.join_all();
+        }
+        // Keys are assigned in file order so ids are deterministic,
+        // then the batch is joined on threads.
+        for ( size_t i = start; i < stop; i++ ) {
+          if ( !pairs[i].error.empty() )
+            vw_throw( IOErr() << pairs[i].error << "\n" );
+          if ( pairs[i].left_ip.size() >= size_t(opt.min_matches) ) {
+            builder.link( pairs[i].left, pairs[i].right,
+                          pairs[i].left_ip, pairs[i].right_ip, pairs[i].links );
+            num_pairs++;
+          }
+          std::vector<Vector2f>().swap( pairs[i].left_ip );
+          std::vector<Vector2f>().swap( pairs[i].right_ip );
+        }
+        {
+          FifoWorkQueue queue( num_threads );
+          for ( size_t i = start; i < stop; i++ )
+            queue.add_task( boost::shared_ptr<Task>( new JoinTask( builder.sets, pairs[i].links ) ) );
+          queue.join_all();
+        }
+        for ( size_t i = start; i < stop; i++ )
+          std::vector<std::pair<uint32,uint32> >().swap( pairs[i].links );
+        tpc.report_progress( double(stop) / double(pairs.size()) );
       }
       tpc.report_finished();
+    } else {
+      BOOST_FOREACH( std::string const& file, opt.bulk_matches ) {
+        std::cout << "Loading : " << file << "\n";
+        io::filtering_istream in;
+        in.push( io::gzip_decompressor() );
+        in.push( io::file_source( file ) );
+
+        int magic_size;
+        std::string magic;
+        in.read( (char*)&magic_size, sizeof(magic_size) );
+        magic.resize( magic_size );
+        in.read( &magic[0], magic_size );
+        if ( magic != "Packed Match File!" )
+          vw_throw( IOErr() << "Seem to have wrong or corrupt packed match file!\n" );
+
+        int header_size;
+        std::string header;
+        std::vector<Vector2f> left_ip, right_ip;
+        std::vector<std::pair<uint32,uint32> > links;
+        in.read( (char*)&header_size, sizeof(header_size) );
+        while ( in.good() ) {
+          header.resize( header_size );
+          in.read( &header[0], header_size );
+          std::vector<Vector2f>* ips[2] = { &left_ip, &right_ip };
+          for ( int side = 0; side < 2; side++ ) {
+            int match_size;
+            in.read( (char*)&match_size, sizeof(match_size) );
+            if ( !in.good() || match_size < 0 )
+              vw_throw( IOErr() << "Corrupt record \"" << header << "\" in " << file << "\n" );
+            ips[side]->resize( match_size );
+            for ( int i = 0; i < match_size; i++ ) {
+              ip::InterestPoint record = read_ip_record( in );
+              (*ips[side])[i] = Vector2f( record.x, record.y );
+            }
+          }
+          if ( !in.good() || left_ip.size() != right_ip.size() )
+            vw_throw( IOErr() << "Corrupt record \"" << header << "\" in " << file
+                      << ": " << left_ip.size() << " left and " << right_ip.size()
+                      << " right matches\n" );
+
+          size_t split = header.find("__");
+          if ( split != std::string::npos &&
+               left_ip.size() >= size_t(opt.min_matches) ) {
+            std::string left = header.substr( 0, split );
+            std::string right = fs::basename( header.substr( split + 2 ) );
+            if ( stem_index.count( left ) && stem_index.count( right ) ) {
+              // Packed records carry no directories to tell these apart
+              if ( shared_stems.count( left ) || shared_stems.count( right ) )
+                vw_throw( ArgumentErr() << "Record \"" << header << "\" in " << file
+                          << " names an image several inputs share.\n" );
+              builder.link( stem_index[left], stem_index[right],
+                            left_ip, right_ip, links );
+              JoinTask( builder.sets, links )();
+              num_pairs++;
+            }
+          }
+          in.read( (char*)&header_size, sizeof(header_size) );
+        }
+      }
     }
+    std::cout << "Used image pairs: " << num_pairs << "\n";
+    std::cout << "Measures:         " << builder.size() << "\n";
+
+    std::vector<uint32> offsets, members;
+    group_tracks( builder.sets, offsets, members );
+    size_t num_tracks = offsets.size() - 1;
 
-    // Build Control Network
-    ba::ControlNetwork cnet( "Rawr" );
-    build_control_network( cnet, camera_models,
-                           opt.input_names, opt.min_matches );
-
-    // Rewrite as NVM
-    write_nvm_r9t( opt.nvm_output,
-                   opt.focal_lengths.begin(), opt.focal_lengths.end(),
-                   opt.rotations.begin(), opt.rotations.end(),
-                   opt.translations.begin(), opt.translations.end(),
-                   cnet );
+    // Triangulate
+    std::vector<Vector3> track_positions( num_tracks );
+    std::vector<char> valid( num_tracks );
+    {
+      TerminalProgressCallback tpc("","Triangulating:");
+      tpc.report_progress(0);
+      size_t chunk = 16384;
+      FifoWorkQueue queue( num_threads );
+      for ( size_t t = 0; t < num_tracks; t += chunk )
+        queue.add_task( boost::shared_ptr<Task>(
+            new TrackTriangulateTask( projectors, builder, offsets, members, t,
+                                      std::min( t + chunk, num_tracks ),
+                                      track_positions, valid ) ) );
+      queue.join_all();
+      tpc.report_finished();
+    }
+
+    // Flatten into the binary NVM blocks
+    std::vector<double> positions;
+    std::vector<uint64> point_offsets( 1, 0 );
+    std::vector<NVMBinaryMeasure> measures;
+    for ( size_t t = 0; t < num_tracks; t++ ) {
+      if ( !valid[t] )
+        continue;
+      for ( size_t k = 0; k < 3; k++ )
+        positions.push_back( track_positions[t][k] );
+      for ( uint32 i = offsets[t]; i < offsets[t+1]; i++ ) {
+        NVMBinaryMeasure measure;
+        measure.image_id = builder.image_id[members[i]];
+        measure.feature_id = builder.feature_id[members[i]];
+        measure.x = builder.position[members[i]][0];
+        measure.y = builder.position[members[i]][1];
+        measures.push_back( measure );
+      }
+      point_offsets.push_back( measures.size() );
+    }
+    std::cout << "Tracks:           " << point_offsets.size() - 1
+              << " (dropped " << num_tracks - point_offsets.size() + 1 << ")\n";
+
+    // Write the NVM straight from the tracks
+    std::ofstream nvm( fs::change_extension( opt.nvm_output, ".nvm" ).string().c_str(),
+                       std::ofstream::out );
+    nvm << std::setprecision(12);
+    nvm << "NVM_V3_R9T\n" << opt.input_names.size() << "\n";
+    for ( size_t i = 0; i < opt.input_names.size(); i++ )
+      write_nvm_r9t( nvm, opt.focal_lengths[i], opt.rotations[i], opt.translations[i] );
+    nvm << point_offsets.size() - 1 << "\n";
+    for ( size_t p = 0; p + 1 < point_offsets.size(); p++ ) {
+      nvm << positions[3*p] << " " << positions[3*p+1] << " " << positions[3*p+2]
+          << " 0 0 0 " << point_offsets[p+1] - point_offsets[p];
+      for ( uint64 i = point_offsets[p]; i < point_offsets[p+1]; i++ )
+        nvm << " " << measures[i].image_id << " " << measures[i].feature_id << " "
+            << measures[i].x << " " << measures[i].y;
+      nvm << "\n";
+    }
+    nvm.close();
+    std::string text_file = fs::change_extension( opt.nvm_output, ".nvm" ).string();
+    write_nvm_companion( text_file, nvm_text_stamp( text_file ), 12,
+                         cameras, positions, point_offsets, measures );
   } catch( Exception const& e) {
     std::cerr << "\n\nVW Error: " << e.what() << std::endl;
     return 1;
@@ -8,9 +8,174 @@ namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
 #include "../pba/nvmio.h"
+#include "../pba/nvm_triangulate.h"
+
+// Mergeable approximate distribution of errors. Bins are spaced
+// logarithmically at 1% resolution between 1e-6 and 1e6 pixels, so
+// per thread histograms can simply be added together. Sum, min and
+// max are exact.
+class ErrorHistogram {
+  static const int BINS_PER_DECADE = 230;
+  static const int DECADES = 12;
+  std::vector<uint64> m_bins;
+  uint64 m_count;
+  double m_sum, m_min, m_max;
+
+  static inline double lower( size_t bin ) {
+    return 1e-6 * pow( 10.0, double(bin) / BINS_PER_DECADE );
+  }
+
+public:
+  ErrorHistogram() : m_bins( BINS_PER_DECADE * DECADES + 2 ), m_count(0),
+                     m_sum(0), m_min(0), m_max(0) {}
+
+  inline void operator()( double error ) {
+    size_t bin;
+    if ( !( error >= 1e-6 ) )
+      bin = 0;
+    else
+      bin = std::min( size_t( log10( error * 1e6 ) * BINS_PER_DECADE ) + 1,
+                      m_bins.size() - 1 );
+    m_bins[bin]++;
+    if ( m_count == 0 || error < m_min ) m_min = error;
+    if ( m_count == 0 || error > m_max ) m_max = error;
+    m_count++;
+    m_sum += error;
+  }
+
+  void merge( ErrorHistogram const& other ) {
+    if ( other.m_count == 0 )
+      return;
+    for ( size_t i = 0; i < m_bins.size(); i++ )
+      m_bins[i] += other.m_bins[i];
+    if ( m_count == 0 || other.m_min < m_min ) m_min = other.m_min;
+    if ( m_count == 0 || other.m_max > m_max ) m_max = other.m_max;
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+  }
+
+  uint64 count() const { return m_count; }
+  double sum() const { return m_sum; }
+
+  double quantile( double q ) const {
+    if ( m_count == 0 )
+      return 0;
+    if ( q <= 0 )
+      return m_min;
+    if ( q >= 1 )
+      return m_max;
+    uint64 target = uint64( ceil( q * double(m_count) ) ), seen = 0;
+    for ( size_t i = 0; i < m_bins.size(); i++ ) {
+      seen += m_bins[i];
+      if ( seen >= target ) {
+        double value = i == 0 ? m_min : sqrt( lower(i-1) * lower(i) );
+        return std::max( m_min, std::min( m_max, value ) );
+      }
+    }
+    return m_max;
+  }
+
+  void print( std::string const& title ) const {
+    std::cout << title << "--------------------------------\n";
+    std::cout << "  Error sum:  " << m_sum << "\n";
+    std::cout << "  Error mean: " << m_sum / double(m_count) << "\n";
+    std::cout << "  [" << quantile(0) << " "
+              << quantile(.25) << " "
+              << quantile(.5)  << " "
+              << quantile(.75) << " "
+              << quantile(1)   << "]\n";
+  }
+};
+
+// Accumulates the errors of a range of points. With a threshold it
+// also drops bad measures and marks points to remove, leaving the
+// network's point list untouched so that it can be compacted once.
+class ErrorRangeTask : public Task {
+  std::vector<NVMProjector> const& m_cameras;
+  ba::ControlNetwork& m_cnet;
+  size_t m_begin, m_end;
+  double m_threshold;
+  std::vector<char>* m_keep;
+  ErrorHistogram& m_total;
+  Mutex& m_mutex;
+  TerminalProgressCallback& m_progress;
+
+public:
+  ErrorRangeTask( std::vector<NVMProjector> const& cameras,
+                  ba::ControlNetwork& cnet, size_t begin, size_t end,
+                  double threshold, std::vector<char>* keep,
+                  ErrorHistogram& total, Mutex& mutex,
+                  TerminalProgressCallback& progress ) :
+    m_cameras(cameras), m_cnet(cnet), m_begin(begin), m_end(end),
+    m_threshold(threshold), m_keep(keep), m_total(total), m_mutex(mutex),
+    m_progress(progress) {}
+
+  virtual ~ErrorRangeTask() {}
+  virtual void operator()() {
+    ErrorHistogram histogram;
+    for ( size_t cpi = m_begin; cpi < m_end; cpi++ ) {
+      ba::ControlPoint& cp = m_cnet[cpi];
+
+      if ( m_keep ) {
+        // Determine if the point is above Apollo
+        if ( norm_2(cp.position()) > 1847e3 ) {
+          (*m_keep)[cpi] = false;
+          continue;
+        }
+      }
+
+      size_t cmi = 0;
+      while ( cmi < cp.size() ) {
+        double error =
+          norm_2(cp[cmi].position() - m_cameras[cp[cmi].image_id()].point_to_pixel(cp.position()));
+        if ( m_keep && error > m_threshold ) {
+          cp.delete_measure(cmi);
+        } else {
+          histogram( error );
+          cmi++;
+        }
+      }
+      if ( m_keep )
+        (*m_keep)[cpi] = cp.size() >= 2;
+    }
+
+    Mutex::Lock lock( m_mutex );
+    m_total.merge( histogram );
+    m_progress.report_incremental_progress( double(m_end - m_begin) /
+                                            double(m_cnet.size()) );
+  }
+};
+
+// Runs ErrorRangeTask over the whole network
+ErrorHistogram network_error( std::vector<NVMProjector> const& cameras,
+                              ba::ControlNetwork& cnet, int num_threads,
+                              double threshold, std::vector<char>* keep,
+                              TerminalProgressCallback& tpc ) {
+  ErrorHistogram total;
+  Mutex mutex;
+  if ( num_threads < 1 )
+    num_threads = 1;
+  size_t chunk = std::max( size_t(1), std::min( size_t(16384),
+                                                cnet.size() / (16 * num_threads) ) );
+  tpc.report_progress(0);
+  {
+    FifoWorkQueue queue( num_threads );
+    for ( size_t i = 0; i < cnet.size(); i += chunk ) {
+      boost::shared_ptr<Task> task( new ErrorRangeTask( cameras, cnet, i,
+                                                        std::min( i + chunk, cnet.size() ),
+                                                        threshold, keep, total,
+                                                        mutex, tpc ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+  }
+  tpc.report_finished();
+  return total;
+}
 
 struct Options {
   double error_threshold;
+  int num_threads;
   std::string nvm_input;
   std::vector<boost::shared_ptr<camera::PinholeModel> > cameras;
 };
@@ -20,6 +185,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   general_options.add_options()
     ("error-threshold,e", po::value(&opt.error_threshold)->default_value(100),
      "Error threshold in pixels.")
+    ("threads,t", po::value(&opt.num_threads)->default_value(vw_settings().default_num_threads()),
+     "Number of threads to measure error with.")
     ("help,h", "Display this help message");
 
   po::options_description positional("");
@@ -62,81 +229,31 @@ int main( int argc, char* argv[] ) {
     std::cout << "Found cameras: " << opt.cameras.size() << "\n";
     std::cout << "Found points : " << cnet.size() << "\n";
 
-    double error_accumulated = 0;
-    uint64 error_cnt = 0;
-    math::CDFAccumulator<double> error_cdf;
+    std::vector<NVMProjector> projectors;
+    projectors.reserve( opt.cameras.size() );
+    BOOST_FOREACH( boost::shared_ptr<camera::PinholeModel> const& cam, opt.cameras )
+      projectors.push_back( NVMProjector( nvm_camera( cam.get() ) ) );
 
-    float inc_amt = 1.0/float(cnet.size());
     TerminalProgressCallback tpc("","Err: ");
-    tpc.report_progress(0);
-    BOOST_FOREACH( ba::ControlPoint& cp, cnet ) {
-      BOOST_FOREACH( ba::ControlMeasure& cm, cp ) {
-        double error =
-          norm_2(cm.position() - opt.cameras[cm.image_id()]->point_to_pixel(cp.position()));
-        error_cdf(error);
-        error_cnt++;
-        error_accumulated+=error;
-      }
-      tpc.report_incremental_progress(inc_amt);
-    }
-    tpc.report_finished();
-    error_cdf.update();
-
-    std::cout << "Before--------------------------------\n";
-    std::cout << "  Error sum:  " << error_accumulated << "\n";
-    std::cout << "  Error mean: " << error_accumulated / double(error_cnt) << "\n";
-    std::cout << "  Apprx mean: " << error_cdf.approximate_mean(0.02) << "\n";
-    std::cout << "  [" << error_cdf.quantile(0) << " "
-              << error_cdf.quantile(.25) << " "
-              << error_cdf.quantile(.5)  << " "
-              << error_cdf.quantile(.75) << " "
-              << error_cdf.quantile(1)   << "]\n";
+    network_error( projectors, cnet, opt.num_threads, 0, NULL, tpc ).print("Before");
 
     tpc.set_progress_text("Cut: ");
-    error_accumulated = 0;
-    error_cnt = 0;
-    error_cdf = math::CDFAccumulator<double>();
-    size_t cpi = 0;
-    tpc.report_progress(0);
-    while ( cpi < cnet.size() ) {
-      tpc.report_incremental_progress(inc_amt);
-
-      // Determine if the point is above Apollo
-      if ( norm_2(cnet[cpi].position()) > 1847e3 ) {
-	cnet.delete_control_point(cpi);
-	break;
-      }
+    std::vector<char> keep( cnet.size(), true );
+    ErrorHistogram after =
+      network_error( projectors, cnet, opt.num_threads, opt.error_threshold, &keep, tpc );
 
-      // Check if the measurements are bad
-      size_t cmi = 0;
-      while ( cmi < cnet[cpi].size() ) {
-        double error =
-          norm_2(cnet[cpi][cmi].position() - opt.cameras[cnet[cpi][cmi].image_id()]->point_to_pixel(cnet[cpi].position()));
-        if ( error > opt.error_threshold ) {
-          cnet[cpi].delete_measure(cmi);
-        } else {
-          error_cdf(error);
-          error_cnt++;
-          error_accumulated+=error;
-          cmi++;
-        }
-      }
-      if ( cnet[cpi].size() < 2 )
-        cnet.delete_control_point(cpi);
-      else
-        cpi++;
+    // Compact the surviving points in a single pass
+    size_t kept = 0;
+    for ( size_t cpi = 0; cpi < cnet.size(); cpi++ ) {
+      if ( !keep[cpi] )
+        continue;
+      if ( kept != cpi )
+        cnet[kept] = cnet[cpi];
+      kept++;
     }
-    tpc.report_finished();
-
-    std::cout << "After--------------------------------\n";
-    std::cout << "  Error sum:  " << error_accumulated << "\n";
-    std::cout << "  Error mean: " << error_accumulated / double(error_cnt) << "\n";
-    std::cout << "  Apprx mean: " << error_cdf.approximate_mean(0.02) << "\n";
-    std::cout << "  [" << error_cdf.quantile(0) << " "
-              << error_cdf.quantile(.25) << " "
-              << error_cdf.quantile(.5)  << " "
-              << error_cdf.quantile(.75) << " "
-              << error_cdf.quantile(1)   << "]\n";
+    std::cout << "Removed points: " << cnet.size() - kept << "\n";
+    cnet.resize( kept );
+    after.print("After");
 
     write_nvm_iterator_ptr( "cut_" + opt.nvm_input,
                             opt.cameras.begin(), opt.cameras.end(),
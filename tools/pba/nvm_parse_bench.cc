@@ -0,0 +1,150 @@
+// Times the buffered NVM text parser, serial and threaded, against the
+// istream reader and checks that all produce the same cameras and
+// control network.
+// Without an input file a synthetic NVM is generated first.
+
+#include <vw/Core.h>
+#include <vw/Math.h>
+using namespace vw;
+
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+
+#include "../pba/nvmio.h"
+
+struct Options {
+  std::string nvm_input;
+  size_t num_points, num_cameras, num_measures;
+};
+
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  po::options_description general_options("");
+  general_options.add_options()
+    ("points", po::value(&opt.num_points)->default_value(2000000),
+     "Points in the synthetic NVM.")
+    ("cameras", po::value(&opt.num_cameras)->default_value(500),
+     "Cameras in the synthetic NVM.")
+    ("measures", po::value(&opt.num_measures)->default_value(4),
+     "Measures per point in the synthetic NVM.")
+    ("help,h", "Display this help message");
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-file", po::value(&opt.nvm_input));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-file", 1);
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] [nvm]\n";
+
+  po::variables_map vm;
+  try {
+    po::options_description all_options;
+    all_options.add(general_options).add(positional);
+    po::store( po::command_line_parser( argc, argv ).options(all_options).positional(positional_desc).run(), vm );
+    po::notify( vm );
+  } catch (po::error const& e) {
+    vw_throw( ArgumentErr() << "Error parsing input:\n"
+              << e.what() << "\n" << usage.str() << "\n" << general_options );
+  }
+
+  if ( vm.count("help") )
+    vw_throw( ArgumentErr() << usage.str() << "\n" << general_options );
+}
+
+void write_synthetic( std::string const& file, Options const& opt ) {
+  std::ofstream nvm( file.c_str() );
+  nvm << std::setprecision(12);
+  nvm << "NVM_V3_R9T\n" << opt.num_cameras << "\n";
+  uint64 state = 1;
+  for ( size_t i = 0; i < opt.num_cameras; i++ ) {
+    nvm << "unknown " << 3800 + i * 0.001;
+    for ( size_t j = 0; j < 12; j++ ) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      nvm << " " << double( state >> 11 ) / double( 1ULL << 53 ) * 2e6 - 1e6;
+    }
+    nvm << " 0 0\n";
+  }
+  nvm << opt.num_points << "\n";
+  for ( size_t i = 0; i < opt.num_points; i++ ) {
+    for ( size_t j = 0; j < 3; j++ ) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      nvm << double( state >> 11 ) / double( 1ULL << 53 ) * 4e6 - 2e6 << " ";
+    }
+    nvm << "0 0 0 " << opt.num_measures;
+    for ( size_t j = 0; j < opt.num_measures; j++ ) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      nvm << " " << (state >> 33) % opt.num_cameras << " 0 "
+          << double( state & 0xffffff ) / 1000 - 8000 << " "
+          << double( (state >> 8) & 0xffffff ) / 1000 - 8000;
+    }
+    nvm << "\n";
+  }
+}
+
+bool same( std::vector<NVMBinaryCamera> const& cam1, ba::ControlNetwork const& cnet1,
+           std::vector<NVMBinaryCamera> const& cam2, ba::ControlNetwork const& cnet2 ) {
+  if ( cam1.size() != cam2.size() || cnet1.size() != cnet2.size() )
+    return false;
+  for ( size_t i = 0; i < cam1.size(); i++ )
+    if ( memcmp( &cam1[i], &cam2[i], sizeof(NVMBinaryCamera) ) != 0 )
+      return false;
+  for ( size_t i = 0; i < cnet1.size(); i++ ) {
+    if ( cnet1[i].position() != cnet2[i].position() ||
+         cnet1[i].size() != cnet2[i].size() )
+      return false;
+    for ( size_t j = 0; j < cnet1[i].size(); j++ )
+      if ( cnet1[i][j].image_id() != cnet2[i][j].image_id() ||
+           cnet1[i][j].position() != cnet2[i][j].position() )
+        return false;
+  }
+  return true;
+}
+
+int main( int argc, char* argv[] ) {
+  Options opt;
+  try {
+    handle_arguments( argc, argv, opt );
+
+    if ( opt.nvm_input.empty() ) {
+      opt.nvm_input = "nvm_parse_bench.nvm";
+      std::cout << "Writing synthetic \"" << opt.nvm_input << "\"\n";
+      write_synthetic( opt.nvm_input, opt );
+    }
+
+    std::vector<NVMBinaryCamera> stream_cameras, buffer_cameras, parallel_cameras;
+    ba::ControlNetwork stream_cnet("stream"), buffer_cnet("buffer"),
+      parallel_cnet("parallel");
+
+    pt::ptime t0 = pt::microsec_clock::local_time();
+    read_nvm_text_stream( opt.nvm_input, stream_cameras, stream_cnet );
+    pt::ptime t1 = pt::microsec_clock::local_time();
+    read_nvm_text( opt.nvm_input, buffer_cameras, buffer_cnet, 1 );
+    pt::ptime t2 = pt::microsec_clock::local_time();
+    read_nvm_text( opt.nvm_input, parallel_cameras, parallel_cnet );
+    pt::ptime t3 = pt::microsec_clock::local_time();
+
+    std::cout << "Points        : " << buffer_cnet.size() << "\n";
+    std::cout << "istream parse : " << (t1 - t0).total_milliseconds() << " ms\n";
+    std::cout << "buffered parse: " << (t2 - t1).total_milliseconds() << " ms\n";
+    std::cout << "parallel parse: " << (t3 - t2).total_milliseconds() << " ms ("
+              << vw_settings().default_num_threads() << " threads)\n";
+
+    if ( !same( stream_cameras, stream_cnet, buffer_cameras, buffer_cnet ) ||
+         !same( buffer_cameras, buffer_cnet, parallel_cameras, parallel_cnet ) ) {
+      std::cerr << "Parsers disagree!\n";
+      return 1;
+    }
+    std::cout << "Results identical.\n";
+  } catch( Exception const& e ) {
+    std::cerr << "\n\nVW Error: " << e.what() << std::endl;
+    return 1;
+  } catch( std::exception const& e ) {
+    std::cerr << "\n\nVW Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -8,38 +8,61 @@ namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
 #include "../pba/nvmio.h"
-
-struct PointSolveModel : public math::LeastSquaresModelBase<PointSolveModel> {
-  typedef Vector<double> result_type;
-  typedef Vector3 domain_type;
-  typedef Matrix<double> jacobian_type;
-
-  std::vector<boost::shared_ptr<camera::PinholeModel> > const& cameras;
-  ba::ControlPoint const& control_point;
-  PointSolveModel(std::vector<boost::shared_ptr<camera::PinholeModel> > const& c,
-                  ba::ControlPoint const& p) :
-    cameras(c), control_point(p) {}
-
-  inline result_type operator()( domain_type const& x ) const {
-    Vector<double> image_e;
-    image_e.set_size( control_point.size() * 2 );
-    for ( size_t i = 0; i < control_point.size(); i++ ) {
-      subvector( image_e, i*2, 2 ) =
-        control_point[i].position() -
-        cameras[control_point[i].image_id()]->point_to_pixel(x);
-    }
-    return image_e;
+#include "../pba/nvm_triangulate.h"
+
+// Refines a contiguous range of points. Every point is independent,
+// so tasks only share the (read only) cameras and write their own
+// slots of the results.
+class RefineRangeTask : public Task {
+  std::vector<NVMProjector> const& m_cameras;
+  ba::ControlNetwork& m_cnet;
+  std::vector<PointRefineResult>& m_results;
+  size_t m_begin, m_end;
+  int m_max_iterations;
+  bool m_seed;
+  Mutex& m_mutex;
+  TerminalProgressCallback& m_progress;
+
+public:
+  RefineRangeTask( std::vector<NVMProjector> const& cameras,
+                   ba::ControlNetwork& cnet,
+                   std::vector<PointRefineResult>& results,
+                   size_t begin, size_t end, int max_iterations, bool seed,
+                   Mutex& mutex, TerminalProgressCallback& progress ) :
+    m_cameras(cameras), m_cnet(cnet), m_results(results), m_begin(begin),
+    m_end(end), m_max_iterations(max_iterations), m_seed(seed),
+    m_mutex(mutex), m_progress(progress) {}
+
+  virtual ~RefineRangeTask() {}
+  virtual void operator()() {
+    for ( size_t i = m_begin; i < m_end; i++ )
+      m_results[i] = refine_point( m_cameras, m_cnet[i], m_max_iterations, m_seed );
+
+    Mutex::Lock lock( m_mutex );
+    m_progress.report_incremental_progress( double(m_end - m_begin) /
+                                            double(m_cnet.size()) );
   }
 };
 
 struct Options {
   std::string nvm_input;
+  int num_threads, max_iterations;
+  bool no_seed;
+  std::string report;
   std::vector<boost::shared_ptr<camera::PinholeModel> > cameras;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
+    ("threads,t", po::value(&opt.num_threads)->default_value(vw_settings().default_num_threads()),
+     "Number of threads to refine points with.")
+    ("max-iterations", po::value(&opt.max_iterations)->default_value(100),
+     "Maximum LM iterations per point.")
+    ("no-seed", po::bool_switch(&opt.no_seed)->default_value(false),
+     "Start LM from the positions in the nvm instead of a midpoint triangulation.")
+    ("report", po::value(&opt.report),
+     "Write per point convergence to this file.")
     ("help,h", "Display this help message");
 
   po::options_description positional("");
@@ -82,22 +105,69 @@ int main( int argc, char* argv[] ) {
     std::cout << "Found cameras: " << opt.cameras.size() << "\n";
     std::cout << "Found points:  " << cnet.size() << "\n";
 
-    float inc_amt = 1.0/float(cnet.size());
+    std::vector<NVMProjector> projectors;
+    projectors.reserve( opt.cameras.size() );
+    BOOST_FOREACH( boost::shared_ptr<camera::PinholeModel> const& cam, opt.cameras )
+      projectors.push_back( NVMProjector( nvm_camera( cam.get() ) ) );
+
+    // Small ranges keep the threads balanced, since points with many
+    // measures cost more.
+    if ( opt.num_threads < 1 )
+      opt.num_threads = 1;
+    size_t chunk = std::max( size_t(1), std::min( size_t(4096),
+                                                  cnet.size() / (16 * opt.num_threads) ) );
+    Mutex mutex;
+    std::vector<PointRefineResult> results( cnet.size() );
     TerminalProgressCallback tpc("","Cnet: ");
     tpc.report_progress(0);
-    BOOST_FOREACH( ba::ControlPoint& p, cnet ) {
-      PointSolveModel model( opt.cameras, p );
-      int status;
-      Vector<double> observation;
-      observation.set_size(2*p.size());
-      Vector3 solution =
-        math::levenberg_marquardt( model, p.position(),
-                                   observation, status );
-      p.set_position(solution);
-      tpc.report_incremental_progress(inc_amt);
+    {
+      FifoWorkQueue queue( opt.num_threads );
+      for ( size_t i = 0; i < cnet.size(); i += chunk ) {
+        boost::shared_ptr<Task> task( new RefineRangeTask( projectors, cnet, results, i,
+                                                           std::min( i + chunk, cnet.size() ),
+                                                           opt.max_iterations, !opt.no_seed,
+                                                           mutex, tpc ) );
+        queue.add_task( task );
+      }
+      queue.join_all();
     }
     tpc.report_finished();
 
+    // Convergence report
+    std::ofstream report;
+    if ( !opt.report.empty() ) {
+      report.open( opt.report.c_str() );
+      if ( !report.is_open() )
+        vw_throw( IOErr() << "Unable to write report: " << opt.report );
+      report << "# index measures seeded iterations converged initial_rms final_rms\n";
+    }
+    size_t total_iterations = 0, num_measures = 0, num_seeded = 0, num_failed = 0;
+    double initial_cost = 0, final_cost = 0;
+    for ( size_t i = 0; i < cnet.size(); i++ ) {
+      PointRefineResult const& r = results[i];
+      total_iterations += r.iterations;
+      num_measures += cnet[i].size();
+      num_seeded += r.seeded;
+      num_failed += !r.converged;
+      initial_cost += r.initial_cost;
+      final_cost += r.final_cost;
+      if ( report.is_open() )
+        report << i << " " << cnet[i].size() << " " << r.seeded << " "
+               << r.iterations << " " << r.converged << " "
+               << sqrt( r.initial_cost / double(cnet[i].size()) ) << " "
+               << sqrt( r.final_cost / double(cnet[i].size()) ) << "\n";
+    }
+    if ( cnet.size() && num_measures ) {
+      std::cout << "Seeded points:    " << num_seeded << "\n";
+      std::cout << "Failed points:    " << num_failed << "\n";
+      std::cout << "Mean iterations:  "
+                << double(total_iterations) / double(cnet.size()) << "\n";
+      std::cout << "RMS error before: "
+                << sqrt( initial_cost / double(num_measures) ) << " px\n";
+      std::cout << "RMS error after:  "
+                << sqrt( final_cost / double(num_measures) ) << " px\n";
+    }
+
     // Write control point
     write_nvm_iterator_ptr( "refine_" + opt.nvm_input,
                             opt.cameras.begin(), opt.cameras.end(),
@@ -1,5 +1,6 @@
 #include <vw/Core.h>
 #include <vw/Math.h>
+#include "../pba/nvmio.h"
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem/path.hpp>
@@ -56,29 +57,20 @@ int main(int argc, char** argv) {
   opts_file << std::setprecision(12);
 
   // Load NVM
-  std::ifstream file(nvm_file.c_str(), std::ios::in);
-  if ( !file.is_open() )
-    vw_throw( ArgumentErr() << "Unable to open: " << nvm_file << "!\n" );
-
-  std::string key;
-  size_t num_cameras, num_points;
-  file >> key >> num_cameras;
-  std::cout << "Key: " << key << "\n";
-  std::cout << "Num Cams: " << num_cameras << "\n";
-
-  // Reading out camera
-  for ( size_t j = 0; j < num_cameras; j++ ) {
-    std::string name;
-    float focal;
+  std::vector<NVMBinaryCamera> cameras;
+  ba::ControlNetwork cnet("nvm_to_bundlevis");
+  read_nvm_data( nvm_file, cameras, cnet );
+  std::cout << "Num Cams: " << cameras.size() << "\n";
+
+  // Writing out camera
+  for ( size_t j = 0; j < cameras.size(); j++ ) {
     Matrix3x3 rotation;
     Vector3 translation;
-    int buf;
-
-    file >> name >> focal >> rotation[0][0] >> rotation[0][1] >> rotation[0][2]
-         >> rotation[1][0] >> rotation[1][1] >> rotation[1][2]
-         >> rotation[2][0] >> rotation[2][1] >> rotation[2][2]
-         >> translation[0] >> translation[1] >> translation[2]
-         >> buf >> buf;
+    for ( size_t r = 0; r < 3; r++ ) {
+      for ( size_t c = 0; c < 3; c++ )
+        rotation(r,c) = cameras[j].rotation[3*r+c];
+      translation[r] = cameras[j].translation[r];
+    }
 
     Quat q(transpose(rotation));
     translation = -transpose(rotation)*translation;
@@ -87,19 +79,11 @@ int main(int argc, char** argv) {
               << q[0] << "\t" << q[1] << "\t" << q[2] << "\t" << q[3] << "\n";
   }
 
-  file >> num_points;
-  std::cout << "Num Pts: " << num_points << "\n";
-
-  // Reading out points
-  for ( size_t i = 0; i < num_points; i++ ) {
-    Vector3 point;
-    file >> point[0] >> point[1] >> point[2];
-
-    // Advance file as I don't care for the rest of the information
-    char c = file.get();
-    while ( c != '\n' && file.good() )
-      c = file.get();
+  std::cout << "Num Pts: " << cnet.size() << "\n";
 
+  // Writing out points
+  for ( size_t i = 0; i < cnet.size(); i++ ) {
+    Vector3 const& point = cnet[i].position();
     opts_file << i << "\t" << point[0] << "\t" << point[1] << "\t" << point[2] << "\n";
   }
 
@@ -0,0 +1,204 @@
+#ifndef __NVM_TRIANGULATE_H__
+#define __NVM_TRIANGULATE_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Matrix.h>
+#include <vw/BundleAdjustment/ControlNetwork.h>
+#include "nvmio.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace vw {
+
+  // World to pixel projection of an NVM R9T camera. Gives the same
+  // pixels as the PinholeModel that nvm_pinhole builds, without the
+  // virtual calls and pose conversions.
+  struct NVMProjector {
+    Matrix3x3 rotation;
+    Vector3 translation;
+    double focal;
+
+    NVMProjector() : focal(0) {}
+    NVMProjector( NVMBinaryCamera const& cam ) : focal( cam.focal ) {
+      for ( size_t i = 0; i < 3; i++ ) {
+        for ( size_t j = 0; j < 3; j++ )
+          rotation(i,j) = cam.rotation[3*i+j];
+        translation[i] = cam.translation[i];
+      }
+    }
+
+    inline Vector2 point_to_pixel( Vector3 const& x ) const {
+      Vector3 p = rotation * x + translation;
+      return focal * Vector2( p[0] / p[2], p[1] / p[2] );
+    }
+
+    // Also returns the derivative of the pixel with respect to x
+    inline Vector2 point_to_pixel( Vector3 const& x,
+                                   Matrix<double,2,3>& jacobian ) const {
+      Vector3 p = rotation * x + translation;
+      double inv_z = 1.0 / p[2];
+      Vector2 normalized( p[0] * inv_z, p[1] * inv_z );
+      Matrix<double,2,3> d_normalized;
+      d_normalized(0,0) = focal * inv_z;
+      d_normalized(0,2) = -focal * normalized[0] * inv_z;
+      d_normalized(1,1) = focal * inv_z;
+      d_normalized(1,2) = -focal * normalized[1] * inv_z;
+      jacobian = d_normalized * rotation;
+      return focal * normalized;
+    }
+  };
+
+  // Sum of squared reprojection errors of x over cp's measures
+  inline double reprojection_cost( std::vector<NVMProjector> const& cameras,
+                                   ba::ControlPoint const& cp,
+                                   Vector3 const& x ) {
+    double cost = 0;
+    for ( size_t i = 0; i < cp.size(); i++ )
+      cost += norm_2_sqr( Vector2( cp[i].position() ) -
+                          cameras[cp[i].image_id()].point_to_pixel( x ) );
+    return cost;
+  }
+
+  // Solves a x = b for a symmetric 3x3 with Cramer's rule
+  inline bool solve_3x3( Matrix3x3 const& a, Vector3 const& b, Vector3& x ) {
+    double det =
+      a(0,0) * ( a(1,1) * a(2,2) - a(1,2) * a(2,1) ) -
+      a(0,1) * ( a(1,0) * a(2,2) - a(1,2) * a(2,0) ) +
+      a(0,2) * ( a(1,0) * a(2,1) - a(1,1) * a(2,0) );
+    if ( !( fabs(det) > 1e-300 ) )
+      return false;
+    for ( size_t k = 0; k < 3; k++ ) {
+      Matrix3x3 ak = a;
+      for ( size_t i = 0; i < 3; i++ )
+        ak(i,k) = b[i];
+      x[k] = ( ak(0,0) * ( ak(1,1) * ak(2,2) - ak(1,2) * ak(2,1) ) -
+               ak(0,1) * ( ak(1,0) * ak(2,2) - ak(1,2) * ak(2,0) ) +
+               ak(0,2) * ( ak(1,0) * ak(2,1) - ak(1,1) * ak(2,0) ) ) / det;
+    }
+    return true;
+  }
+
+  // N-view midpoint: the point closest in the least squares sense to
+  // every measure's viewing ray. Fails for fewer than two rays or when
+  // the rays are parallel.
+  inline bool triangulate_midpoint( std::vector<NVMProjector> const& cameras,
+                                    ba::ControlPoint const& cp, Vector3& x ) {
+    if ( cp.size() < 2 )
+      return false;
+    Matrix3x3 a;
+    Vector3 b;
+    for ( size_t i = 0; i < cp.size(); i++ ) {
+      NVMProjector const& cam = cameras[cp[i].image_id()];
+      Vector3 center = -transpose(cam.rotation) * cam.translation;
+      Vector3 direction =
+        normalize( transpose(cam.rotation) *
+                   Vector3( cp[i].position()[0] / cam.focal,
+                            cp[i].position()[1] / cam.focal, 1 ) );
+      // Projector onto the plane perpendicular to the ray
+      Matrix3x3 perp;
+      for ( size_t r = 0; r < 3; r++ )
+        for ( size_t c = 0; c < 3; c++ )
+          perp(r,c) = ( r == c ? 1 : 0 ) - direction[r] * direction[c];
+      a += perp;
+      b += perp * center;
+    }
+    if ( !solve_3x3( a, b, x ) )
+      return false;
+
+    // Must be in front of every camera
+    for ( size_t i = 0; i < cp.size(); i++ ) {
+      NVMProjector const& cam = cameras[cp[i].image_id()];
+      if ( cam.rotation(2,0) * x[0] + cam.rotation(2,1) * x[1] +
+           cam.rotation(2,2) * x[2] + cam.translation[2] <= 0 )
+        return false;
+    }
+    return true;
+  }
+
+  struct PointRefineResult {
+    int iterations;
+    double initial_cost, final_cost;
+    bool converged, seeded;
+  };
+
+  // Levenberg-Marquardt on a single point's position with the
+  // analytic pinhole Jacobian. Everything is fixed size, so nothing is
+  // allocated per iteration. With seed, LM starts from the midpoint
+  // triangulation whenever it beats the point's current position.
+  inline PointRefineResult refine_point( std::vector<NVMProjector> const& cameras,
+                                         ba::ControlPoint& cp,
+                                         int max_iterations = 100,
+                                         bool seed = true ) {
+    PointRefineResult result;
+    Vector3 x = cp.position();
+    double cost = reprojection_cost( cameras, cp, x );
+    result.initial_cost = cost;
+    result.iterations = 0;
+    result.converged = false;
+    result.seeded = false;
+
+    Vector3 midpoint;
+    if ( seed && triangulate_midpoint( cameras, cp, midpoint ) ) {
+      double midpoint_cost = reprojection_cost( cameras, cp, midpoint );
+      if ( midpoint_cost < cost || cost != cost ) {
+        x = midpoint;
+        cost = midpoint_cost;
+        result.seeded = true;
+      }
+    }
+
+    double lambda = 1e-3;
+    Matrix<double,2,3> jacobian;
+    while ( result.iterations < max_iterations ) {
+      result.iterations++;
+
+      // Normal equations
+      Matrix3x3 jtj;
+      Vector3 jte;
+      for ( size_t i = 0; i < cp.size(); i++ ) {
+        Vector2 error = Vector2( cp[i].position() ) -
+          cameras[cp[i].image_id()].point_to_pixel( x, jacobian );
+        jtj += transpose(jacobian) * jacobian;
+        jte += transpose(jacobian) * error;
+      }
+
+      // Raise damping until a step lowers the cost
+      bool improved = false;
+      double decrease = 0;
+      Vector3 delta;
+      while ( lambda < 1e10 ) {
+        Matrix3x3 damped = jtj;
+        for ( size_t k = 0; k < 3; k++ )
+          damped(k,k) *= 1 + lambda;
+        if ( solve_3x3( damped, jte, delta ) ) {
+          Vector3 x_new = x + delta;
+          double cost_new = reprojection_cost( cameras, cp, x_new );
+          if ( cost_new < cost ) {
+            decrease = ( cost - cost_new ) / cost;
+            x = x_new;
+            cost = cost_new;
+            lambda = std::max( lambda * 0.1, 1e-12 );
+            improved = true;
+            break;
+          }
+        }
+        lambda *= 10;
+      }
+
+      if ( !improved || decrease < 1e-10 ||
+           norm_2( delta ) < 1e-12 * ( norm_2( x ) + 1e-12 ) ) {
+        result.converged = true;
+        break;
+      }
+    }
+
+    cp.set_position( x );
+    result.final_cost = cost;
+    return result;
+  }
+
+}
+
+#endif//__NVM_TRIANGULATE_H__
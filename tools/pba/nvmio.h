@@ -1,14 +1,358 @@
 #ifndef __NVM_IO_H__
 #define __NVM_IO_H__
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Camera/CameraModel.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/BundleAdjustment/ControlNetwork.h>
 #include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace vw {
 
+  // Binary NVM
+  //
+  // Companion to the text NVM_V3_R9T format that can be mapped straight
+  // into memory. Layout, all in native byte order:
+  //   NVMBinaryHeader
+  //   NVMBinaryCamera[num_cameras]
+  //   double[num_points][3]         point positions
+  //   uint64[num_points+1]          CSR offsets into the measures
+  //   NVMBinaryMeasure[num_measures]
+  // Every block is a multiple of 8 bytes so each stays aligned.
+  //
+  // A companion written next to a text NVM records the text file's
+  // identity and holds exactly the values the text parses to.
+
+  // Identity of a file: size, inode and nanosecond modification time.
+  // All zero for a standalone binary NVM.
+  struct NVMTextStamp {
+    uint64 size, inode;
+    int64 mtime_sec, mtime_nsec;
+  };
+  inline bool operator==( NVMTextStamp const& a, NVMTextStamp const& b ) {
+    return a.size == b.size && a.inode == b.inode &&
+      a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec;
+  }
+  inline NVMTextStamp nvm_text_stamp( std::string const& file ) {
+    NVMTextStamp stamp;
+    memset( &stamp, 0, sizeof(stamp) );
+    struct stat info;
+    if ( stat( file.c_str(), &info ) != 0 )
+      return stamp;
+    stamp.size = info.st_size;
+    stamp.inode = info.st_ino;
+#ifdef __APPLE__
+    stamp.mtime_sec = info.st_mtimespec.tv_sec;
+    stamp.mtime_nsec = info.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime_sec = info.st_mtim.tv_sec;
+    stamp.mtime_nsec = info.st_mtim.tv_nsec;
+#endif
+    return stamp;
+  }
+
+  struct NVMBinaryHeader {
+    char magic[8];
+    uint64 num_cameras, num_points, num_measures;
+    NVMTextStamp text;
+  };
+  struct NVMBinaryCamera {
+    double focal;
+    double rotation[9];    // Row major world to camera rotation
+    double translation[3];
+  };
+  struct NVMBinaryMeasure {
+    uint32 image_id, feature_id;
+    double x, y;
+  };
+  static const char NVM_BINARY_MAGIC[8] = {'N','V','M','B','I','N','0','2'};
+
+  inline bool is_nvm_binary( std::string const& file ) {
+    std::ifstream stream( file.c_str(), std::ios::in | std::ios::binary );
+    char magic[8];
+    if ( !stream.read( magic, 8 ) )
+      return false;
+    return memcmp( magic, NVM_BINARY_MAGIC, 8 ) == 0;
+  }
+
+  // Read only memory map of a binary NVM file
+  class NVMBinaryFile : private boost::noncopyable {
+    int m_fd;
+    size_t m_size;
+    char const* m_data;
+    NVMBinaryHeader const* m_header;
+
+    template <class T>
+    T const* block( size_t offset ) const {
+      return reinterpret_cast<T const*>( m_data + offset );
+    }
+    size_t camera_offset() const { return sizeof(NVMBinaryHeader); }
+    size_t position_offset() const {
+      return camera_offset() + m_header->num_cameras * sizeof(NVMBinaryCamera);
+    }
+    size_t offset_offset() const {
+      return position_offset() + m_header->num_points * 3 * sizeof(double);
+    }
+    size_t measure_offset() const {
+      return offset_offset() + (m_header->num_points + 1) * sizeof(uint64);
+    }
+
+  public:
+    NVMBinaryFile( std::string const& file ) : m_fd(-1), m_size(0), m_data(0) {
+      m_fd = open( file.c_str(), O_RDONLY );
+      if ( m_fd < 0 )
+        vw_throw( ArgumentErr() << "Unable to open: " << file << "!\n" );
+      struct stat info;
+      fstat( m_fd, &info );
+      m_size = info.st_size;
+      if ( m_size < sizeof(NVMBinaryHeader) ) {
+        close( m_fd );
+        vw_throw( IOErr() << "Binary NVM is truncated: " << file << "\n" );
+      }
+      void* data = mmap( 0, m_size, PROT_READ, MAP_SHARED, m_fd, 0 );
+      if ( data == MAP_FAILED ) {
+        close( m_fd );
+        vw_throw( IOErr() << "Unable to map: " << file << "\n" );
+      }
+      m_data = static_cast<char const*>( data );
+      m_header = block<NVMBinaryHeader>( 0 );
+      if ( memcmp( m_header->magic, NVM_BINARY_MAGIC, 8 ) != 0 ||
+           m_size < measure_offset() + m_header->num_measures * sizeof(NVMBinaryMeasure) ) {
+        munmap( const_cast<char*>( m_data ), m_size );
+        close( m_fd );
+        vw_throw( IOErr() << "Invalid binary NVM: " << file << "\n" );
+      }
+    }
+    ~NVMBinaryFile() {
+      munmap( const_cast<char*>( m_data ), m_size );
+      close( m_fd );
+    }
+
+    NVMTextStamp const& text_stamp() const { return m_header->text; }
+    size_t num_cameras() const { return m_header->num_cameras; }
+    size_t num_points() const { return m_header->num_points; }
+    size_t num_measures() const { return m_header->num_measures; }
+    NVMBinaryCamera const* cameras() const { return block<NVMBinaryCamera>( camera_offset() ); }
+    double const* positions() const { return block<double>( position_offset() ); }
+    uint64 const* offsets() const { return block<uint64>( offset_offset() ); }
+    NVMBinaryMeasure const* measures() const { return block<NVMBinaryMeasure>( measure_offset() ); }
+
+    void load( std::vector<NVMBinaryCamera>& cameras,
+               ba::ControlNetwork& cnet ) const {
+      cameras.assign( this->cameras(), this->cameras() + num_cameras() );
+      cnet.resize( num_points() );
+      double const* position = positions();
+      uint64 const* offset = offsets();
+      NVMBinaryMeasure const* measure = measures();
+      for ( size_t i = 0; i < num_points(); i++ ) {
+        ba::ControlPoint& cp = cnet[i];
+        cp.set_position( Vector3( position[3*i], position[3*i+1], position[3*i+2] ) );
+        cp.resize( offset[i+1] - offset[i] );
+        for ( size_t j = 0; j < cp.size(); j++ ) {
+          NVMBinaryMeasure const& m = measure[offset[i] + j];
+          cp[j] = ba::ControlMeasure( m.x, m.y, 1, 1, m.image_id );
+        }
+      }
+    }
+  };
+
+  // Writes a binary NVM from its flat blocks. offsets has one more
+  // entry than there are points. The file is written under a name
+  // unique to this process and then renamed over file, so readers that
+  // have the old one mapped never see it truncated or half written.
+  void write_nvm_binary( std::string const& file,
+                         std::vector<NVMBinaryCamera> const& cameras,
+                         std::vector<double> const& positions,
+                         std::vector<uint64> const& offsets,
+                         std::vector<NVMBinaryMeasure> const& measures,
+                         NVMTextStamp const* text = 0 ) {
+    std::ostringstream tmp_stream;
+    tmp_stream << file << ".tmp." << getpid();
+    std::string tmp = tmp_stream.str();
+    std::ofstream out( tmp.c_str(), std::ios::out | std::ios::binary );
+    if ( !out.is_open() )
+      vw_throw( IOErr() << "Unable to write: " << tmp << "\n" );
+
+    NVMBinaryHeader header;
+    memcpy( header.magic, NVM_BINARY_MAGIC, 8 );
+    header.num_cameras = cameras.size();
+    header.num_points = positions.size() / 3;
+    header.num_measures = measures.size();
+    if ( text )
+      header.text = *text;
+    else
+      memset( &header.text, 0, sizeof(header.text) );
+    out.write( reinterpret_cast<char const*>(&header), sizeof(header) );
+    if ( !cameras.empty() )
+      out.write( reinterpret_cast<char const*>(&cameras[0]),
+                 cameras.size() * sizeof(NVMBinaryCamera) );
+    if ( !positions.empty() )
+      out.write( reinterpret_cast<char const*>(&positions[0]),
+                 positions.size() * sizeof(double) );
+    out.write( reinterpret_cast<char const*>(&offsets[0]),
+               offsets.size() * sizeof(uint64) );
+    if ( !measures.empty() )
+      out.write( reinterpret_cast<char const*>(&measures[0]),
+                 measures.size() * sizeof(NVMBinaryMeasure) );
+    out.close();
+    if ( !out ) {
+      unlink( tmp.c_str() );
+      vw_throw( IOErr() << "Failed writing: " << tmp << "\n" );
+    }
+    // POSIX rename replaces file atomically, which boost's v2 rename
+    // refuses to do when file exists
+    if ( std::rename( tmp.c_str(), file.c_str() ) != 0 ) {
+      unlink( tmp.c_str() );
+      vw_throw( IOErr() << "Unable to move " << tmp << " to " << file << "\n" );
+    }
+  }
+
+  void flatten_nvm( ba::ControlNetwork const& cnet,
+                    std::vector<double>& positions,
+                    std::vector<uint64>& offsets,
+                    std::vector<NVMBinaryMeasure>& measures ) {
+    size_t num_points = 0, num_measures = 0;
+    BOOST_FOREACH( ba::ControlPoint const& cp, cnet ) {
+      if ( cp.type() == ba::ControlPoint::GroundControlPoint )
+        continue;
+      num_points++;
+      num_measures += cp.size();
+    }
+
+    positions.clear();
+    offsets.clear();
+    measures.clear();
+    positions.reserve( 3 * num_points );
+    offsets.reserve( num_points + 1 );
+    measures.reserve( num_measures );
+    offsets.push_back( 0 );
+    BOOST_FOREACH( ba::ControlPoint const& cp, cnet ) {
+      if ( cp.type() == ba::ControlPoint::GroundControlPoint )
+        continue;
+      for ( size_t k = 0; k < 3; k++ )
+        positions.push_back( cp.position()[k] );
+      BOOST_FOREACH( ba::ControlMeasure const& cm, cp ) {
+        NVMBinaryMeasure m;
+        m.image_id = cm.image_id();
+        m.feature_id = 0;
+        m.x = cm.position()[0];
+        m.y = cm.position()[1];
+        measures.push_back( m );
+      }
+      offsets.push_back( measures.size() );
+    }
+  }
+
+  void write_nvm_binary( std::string const& file,
+                         std::vector<NVMBinaryCamera> const& cameras,
+                         ba::ControlNetwork const& cnet ) {
+    std::vector<double> positions;
+    std::vector<uint64> offsets;
+    std::vector<NVMBinaryMeasure> measures;
+    flatten_nvm( cnet, positions, offsets, measures );
+    write_nvm_binary( file, cameras, positions, offsets, measures );
+  }
+
+  // The value a text NVM written at precision gives back when parsed
+  inline double nvm_text_value( double value, int precision ) {
+    char buf[64];
+    snprintf( buf, sizeof(buf), "%.*g", precision, value );
+    return strtod( buf, 0 );
+  }
+
+  // Writes the .bnvm companion of text_file from the values that were
+  // written to it at precision, rounded to what the text parses to:
+  // doubles at the text's precision and measures at float. Rounds the
+  // blocks in place. A precision of 0 means the values were parsed
+  // from the text and are stored as they are. Failing to write only
+  // warns, since the text NVM is already complete.
+  void write_nvm_companion( std::string const& text_file,
+                            NVMTextStamp const& stamp, int precision,
+                            std::vector<NVMBinaryCamera> cameras,
+                            std::vector<double>& positions,
+                            std::vector<uint64> const& offsets,
+                            std::vector<NVMBinaryMeasure>& measures ) {
+    namespace fs = boost::filesystem;
+    if ( precision > 0 ) {
+      BOOST_FOREACH( NVMBinaryCamera& cam, cameras ) {
+        cam.focal = nvm_text_value( cam.focal, precision );
+        for ( size_t i = 0; i < 9; i++ )
+          cam.rotation[i] = nvm_text_value( cam.rotation[i], precision );
+        for ( size_t i = 0; i < 3; i++ )
+          cam.translation[i] = nvm_text_value( cam.translation[i], precision );
+      }
+      BOOST_FOREACH( double& position, positions )
+        position = nvm_text_value( position, precision );
+      BOOST_FOREACH( NVMBinaryMeasure& m, measures ) {
+        m.x = float( nvm_text_value( m.x, precision ) );
+        m.y = float( nvm_text_value( m.y, precision ) );
+      }
+    }
+    try {
+      write_nvm_binary( fs::change_extension( text_file, ".bnvm" ).string(),
+                        cameras, positions, offsets, measures, &stamp );
+    } catch ( IOErr const& e ) {
+      vw_out(WarningMessage) << "Unable to cache binary NVM: " << e.what() << "\n";
+    }
+  }
+
+  void write_nvm_companion( std::string const& text_file,
+                            NVMTextStamp const& stamp, int precision,
+                            std::vector<NVMBinaryCamera> const& cameras,
+                            ba::ControlNetwork const& cnet ) {
+    std::vector<double> positions;
+    std::vector<uint64> offsets;
+    std::vector<NVMBinaryMeasure> measures;
+    flatten_nvm( cnet, positions, offsets, measures );
+    write_nvm_companion( text_file, stamp, precision, cameras,
+                         positions, offsets, measures );
+  }
+
+  // Conversions between cameras and their R9T parameters
+  NVMBinaryCamera nvm_camera( camera::PinholeModel const* cam ) {
+    NVMBinaryCamera result;
+    result.focal = cam->focal_length()[0];
+    Matrix3x3 rot = transpose(cam->camera_pose().rotation_matrix());
+    Vector3 trans = -(rot*cam->camera_center());
+    for ( size_t i = 0; i < 3; i++ ) {
+      for ( size_t j = 0; j < 3; j++ )
+        result.rotation[3*i+j] = rot(i,j);
+      result.translation[i] = trans[i];
+    }
+    return result;
+  }
+  camera::PinholeModel* nvm_pinhole( NVMBinaryCamera const& cam ) {
+    Matrix3x3 rotation;
+    Vector3 translation;
+    for ( size_t i = 0; i < 3; i++ ) {
+      for ( size_t j = 0; j < 3; j++ )
+        rotation(i,j) = cam.rotation[3*i+j];
+      translation[i] = cam.translation[i];
+    }
+    Vector3 center = -transpose(rotation)*translation;
+    return new camera::PinholeModel( center, transpose(rotation),
+                                     cam.focal, cam.focal, 0, 0,
+                                     Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1),
+                                     camera::NullLensDistortion() );
+  }
+
   // Writing functions
   void write_nvm_camera(std::ostream& stream,
                         camera::PinholeModel const* cam) {
@@ -44,19 +388,93 @@ namespace vw {
     }
     stream << "\n";
   }
+  // Formats points [m_begin,m_end) of the index list into a text
+  // buffer exactly as the ostream operators would at the given
+  // precision with the default float format.
+  class NVMPointFormatTask : public Task {
+    ba::ControlNetwork const& m_cnet;
+    std::vector<size_t> const& m_index;
+    size_t m_begin, m_end;
+    int m_precision;
+    std::string& m_out;
+
+    void append( double value ) {
+      char buf[64];
+      int length = snprintf( buf, sizeof(buf), "%.*g", m_precision, value );
+      m_out.append( buf, length );
+    }
+    void append( size_t value ) {
+      char buf[32];
+      char* p = buf + sizeof(buf);
+      do {
+        *--p = char( '0' + value % 10 );
+        value /= 10;
+      } while ( value );
+      m_out.append( p, buf + sizeof(buf) - p );
+    }
+
+  public:
+    NVMPointFormatTask( ba::ControlNetwork const& cnet, std::vector<size_t> const& index,
+                        size_t begin, size_t end, int precision, std::string& out ) :
+      m_cnet(cnet), m_index(index), m_begin(begin), m_end(end),
+      m_precision(precision), m_out(out) {}
+    virtual ~NVMPointFormatTask() {}
+    virtual void operator()() {
+      m_out.clear();
+      m_out.reserve( ( m_end - m_begin ) * 128 );
+      for ( size_t i = m_begin; i < m_end; i++ ) {
+        ba::ControlPoint const& cp = m_cnet[m_index[i]];
+        for ( size_t k = 0; k < 3; k++ ) {
+          append( double( cp.position()[k] ) );
+          m_out += ' ';
+        }
+        m_out += "0 0 0 ";
+        append( size_t( cp.size() ) );
+        BOOST_FOREACH( ba::ControlMeasure const& cm, cp ) {
+          m_out += ' ';
+          append( size_t( cm.image_id() ) );
+          m_out += " 0 ";
+          append( double( cm.position()[0] ) );
+          m_out += ' ';
+          append( double( cm.position()[1] ) );
+        }
+        m_out += '\n';
+      }
+    }
+  };
+
+  // Point lines are formatted on num_threads threads, chunk points to
+  // a buffer, and written out in order with one write per buffer.
   void write_nvm_controlnetwork( std::ostream& stream,
-                                 ba::ControlNetwork const& cnet ) {
-    stream << cnet.size() - cnet.num_ground_control_points() << "\n";
-    BOOST_FOREACH( ba::ControlPoint const& cp, cnet ) {
-      if ( cp.type() == ba::ControlPoint::GroundControlPoint )
-        continue;
-      stream << cp.position()[0] << " " << cp.position()[1] << " "
-          << cp.position()[2] << " 0 0 0 " << cp.size();
-      BOOST_FOREACH( ba::ControlMeasure const& cm, cp ) {
-        stream << " " << cm.image_id() << " 0 "
-               << cm.position()[0] << " " << cm.position()[1];
+                                 ba::ControlNetwork const& cnet,
+                                 int num_threads = vw_settings().default_num_threads(),
+                                 size_t chunk = 16384 ) {
+    std::vector<size_t> index;
+    index.reserve( cnet.size() );
+    for ( size_t i = 0; i < cnet.size(); i++ )
+      if ( cnet[i].type() != ba::ControlPoint::GroundControlPoint )
+        index.push_back( i );
+    stream << index.size() << "\n";
+
+    if ( num_threads < 1 )
+      num_threads = 1;
+    int precision = stream.precision();
+    size_t batch = chunk * num_threads * 2;
+    std::vector<std::string> buffers;
+    for ( size_t start = 0; start < index.size(); start += batch ) {
+      size_t stop = std::min( start + batch, index.size() );
+      buffers.resize( ( stop - start + chunk - 1 ) / chunk );
+      {
+        FifoWorkQueue queue( num_threads );
+        for ( size_t b = 0; b < buffers.size(); b++ )
+          queue.add_task( boost::shared_ptr<Task>(
+              new NVMPointFormatTask( cnet, index, start + b * chunk,
+                                      std::min( start + (b+1) * chunk, stop ),
+                                      precision, buffers[b] ) ) );
+        queue.join_all();
       }
-      stream << "\n";
+      BOOST_FOREACH( std::string const& buffer, buffers )
+        stream.write( buffer.data(), buffer.size() );
     }
   }
 
@@ -73,12 +491,20 @@ namespace vw {
                        std::ofstream::out );
     nvm << std::setprecision(12);
     nvm << "NVM_V3_R9T\n" << num_cameras << "\n";
+    std::vector<NVMBinaryCamera> cameras;
+    cameras.reserve( num_cameras );
     while ( begin != end ) {
       boost::shared_ptr<camera::PinholeModel> pin(*begin);
       write_nvm_camera( nvm, pin.get() );
+      cameras.push_back( nvm_camera( pin.get() ) );
       begin++;
     }
     write_nvm_controlnetwork( nvm, cnet );
+    nvm.close();
+
+    std::string text_file = fs::change_extension( file, ".nvm" ).string();
+    write_nvm_companion( text_file, nvm_text_stamp( text_file ), 12,
+                         cameras, cnet );
   }
 
   template <class FocalT, class RotT, class TransT>
@@ -95,32 +521,44 @@ namespace vw {
                        std::ofstream::out );
     nvm << std::setprecision(12);
     nvm << "NVM_V3_R9T\n" << num_cameras << "\n";
+    std::vector<NVMBinaryCamera> cameras;
+    cameras.reserve( num_cameras );
     while ( f_begin != f_end ) {
       write_nvm_r9t(nvm, *f_begin, *rot_begin,
                     *trns_begin );
+      NVMBinaryCamera cam;
+      cam.focal = *f_begin;
+      for ( size_t i = 0; i < 3; i++ ) {
+        for ( size_t j = 0; j < 3; j++ )
+          cam.rotation[3*i+j] = (*rot_begin)(i,j);
+        cam.translation[i] = (*trns_begin)[i];
+      }
+      cameras.push_back( cam );
       f_begin++;
       rot_begin++;
       trns_begin++;
     }
     write_nvm_controlnetwork( nvm, cnet );
+    nvm.close();
+
+    std::string text_file = fs::change_extension( file, ".nvm" ).string();
+    write_nvm_companion( text_file, nvm_text_stamp( text_file ), 12,
+                         cameras, cnet );
   }
 
   // Reading functions
-  camera::PinholeModel* read_nvm_camera(std::istream& stream) {
-    double focal; std::string name; int buf;
-    Vector3 translation;
-    Matrix3x3 rotation;
-    stream >> name >> focal
-           >> rotation(0,0) >> rotation(0,1) >> rotation(0,2)
-           >> rotation(1,0) >> rotation(1,1) >> rotation(1,2)
-           >> rotation(2,0) >> rotation(2,1) >> rotation(2,2)
-           >> translation[0] >> translation[1] >> translation[2]
+  void read_nvm_camera(std::istream& stream, NVMBinaryCamera& cam) {
+    std::string name; int buf;
+    stream >> name >> cam.focal;
+    for ( size_t i = 0; i < 9; i++ )
+      stream >> cam.rotation[i];
+    stream >> cam.translation[0] >> cam.translation[1] >> cam.translation[2]
            >> buf >> buf;
-    Vector3 center = -transpose(rotation)*translation;
-    return new camera::PinholeModel( center, transpose(rotation),
-                                     focal, focal, 0, 0,
-                                     Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1),
-                                     camera::NullLensDistortion() );
+  }
+  camera::PinholeModel* read_nvm_camera(std::istream& stream) {
+    NVMBinaryCamera cam;
+    read_nvm_camera( stream, cam );
+    return nvm_pinhole( cam );
   }
   template <class RotT, class TransT>
   void read_nvm_r9t(std::istream& stream,
@@ -152,25 +590,356 @@ namespace vw {
     }
   }
 
-  // User reading functions
-  template <class CameraStructT>
-  void read_nvm_iterator_ptr( std::string const& file,
-                              CameraStructT& camera_structure,
-                              ba::ControlNetwork& cnet ) {
+  // Locale independent scanner over an NVM held in memory. Numbers
+  // with at most 15 significant digits and a small exponent are
+  // converted exactly with one multiply or divide; anything else goes
+  // through strtod, so results always match the stream extractors.
+  // read_float rounds once to float, as ">> float" does.
+  class NVMTextScanner {
+    char const* m_pos;
+    char const* m_end;
+
+    static bool is_digit( char c ) { return c >= '0' && c <= '9'; }
+    void skip_space() {
+      while ( m_pos < m_end && is_space( *m_pos ) )
+        m_pos++;
+    }
+    void fail( char const* what ) const {
+      vw_throw( IOErr() << "NVM parse error: expected " << what << "\n" );
+    }
+
+  public:
+    NVMTextScanner( char const* begin, char const* end ) : m_pos(begin), m_end(end) {}
+
+    static bool is_space( char c ) {
+      return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    char const* position() const { return m_pos; }
+    bool at_end() { skip_space(); return m_pos >= m_end; }
+
+    // Consumes the rest of the current line. Returns false if anything
+    // other than whitespace was left on it.
+    bool finish_line() {
+      while ( m_pos < m_end && *m_pos != '\n' ) {
+        if ( !is_space( *m_pos ) )
+          return false;
+        m_pos++;
+      }
+      if ( m_pos < m_end )
+        m_pos++;
+      return true;
+    }
+
+    std::string read_token() {
+      skip_space();
+      char const* start = m_pos;
+      while ( m_pos < m_end && !is_space( *m_pos ) )
+        m_pos++;
+      if ( start == m_pos )
+        fail( "a token" );
+      return std::string( start, m_pos );
+    }
+
+    int64 read_int() {
+      skip_space();
+      bool negative = false;
+      if ( m_pos < m_end && ( *m_pos == '-' || *m_pos == '+' ) )
+        negative = *m_pos++ == '-';
+      if ( m_pos >= m_end || !is_digit( *m_pos ) )
+        fail( "an integer" );
+      int64 value = 0;
+      while ( m_pos < m_end && is_digit( *m_pos ) )
+        value = value * 10 + ( *m_pos++ - '0' );
+      return negative ? -value : value;
+    }
+
+    double read_double() {
+      static const double pow10[] =
+        { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+          1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+      skip_space();
+      char const* start = m_pos;
+      bool negative = false;
+      if ( m_pos < m_end && ( *m_pos == '-' || *m_pos == '+' ) )
+        negative = *m_pos++ == '-';
+
+      uint64 mantissa = 0;
+      int digits = 0, exponent = 0;
+      bool any = false, exact = true;
+      while ( m_pos < m_end && is_digit( *m_pos ) ) {
+        any = true;
+        if ( digits < 19 ) {
+          mantissa = mantissa * 10 + ( *m_pos - '0' );
+          if ( mantissa ) digits++;
+        } else {
+          exponent++;
+          exact = false;
+        }
+        m_pos++;
+      }
+      if ( m_pos < m_end && *m_pos == '.' ) {
+        m_pos++;
+        while ( m_pos < m_end && is_digit( *m_pos ) ) {
+          any = true;
+          if ( digits < 19 ) {
+            mantissa = mantissa * 10 + ( *m_pos - '0' );
+            if ( mantissa ) digits++;
+            exponent--;
+          } else {
+            exact = false;
+          }
+          m_pos++;
+        }
+      }
+      if ( any && m_pos < m_end && ( *m_pos == 'e' || *m_pos == 'E' ) ) {
+        char const* mark = m_pos++;
+        bool exp_negative = false;
+        if ( m_pos < m_end && ( *m_pos == '-' || *m_pos == '+' ) )
+          exp_negative = *m_pos++ == '-';
+        if ( m_pos < m_end && is_digit( *m_pos ) ) {
+          int value = 0;
+          while ( m_pos < m_end && is_digit( *m_pos ) ) {
+            if ( value < 10000 )
+              value = value * 10 + ( *m_pos - '0' );
+            m_pos++;
+          }
+          exponent += exp_negative ? -value : value;
+        } else {
+          m_pos = mark;
+        }
+      }
+
+      if ( any && exact && digits <= 15 && exponent >= -22 && exponent <= 22 ) {
+        double value = double(mantissa);
+        value = exponent < 0 ? value / pow10[-exponent] : value * pow10[exponent];
+        return negative ? -value : value;
+      }
+
+      // Slow path for long mantissas, large exponents, nan and inf
+      m_pos = start;
+      while ( m_pos < m_end && !is_space( *m_pos ) )
+        m_pos++;
+      std::string token( start, m_pos );
+      char* token_end;
+      double value = strtod( token.c_str(), &token_end );
+      if ( token_end == token.c_str() )
+        fail( "a number" );
+      return value;
+    }
+
+    // Going through the correctly rounded double only rounds
+    // differently when that double lies exactly halfway between two
+    // floats, so only those are parsed again with strtof.
+    float read_float() {
+      skip_space();
+      char const* start = m_pos;
+      double value = read_double();
+      float result = float( value );
+      if ( double( result ) != value && value == value ) {
+        float other = nextafterf( result, value > result ? HUGE_VALF : -HUGE_VALF );
+        if ( value == ( double( result ) + double( other ) ) / 2 ) {
+          std::string token( start, m_pos );
+          result = strtof( token.c_str(), 0 );
+        }
+      }
+      return result;
+    }
+  };
+
+  void read_nvm_camera( NVMTextScanner& scanner, NVMBinaryCamera& cam ) {
+    scanner.read_token(); // name
+    cam.focal = scanner.read_double();
+    for ( size_t i = 0; i < 9; i++ )
+      cam.rotation[i] = scanner.read_double();
+    for ( size_t i = 0; i < 3; i++ )
+      cam.translation[i] = scanner.read_double();
+    scanner.read_int();
+    scanner.read_int();
+  }
+
+  // Measurements are kept at float precision, as the stream reader did
+  void read_nvm_measurement( NVMTextScanner& scanner, ba::ControlPoint& cp ) {
+    Vector3 position;
+    for ( size_t i = 0; i < 3; i++ )
+      position[i] = scanner.read_double();
+    for ( size_t i = 0; i < 3; i++ )
+      scanner.read_double();
+    size_t num_measurements = scanner.read_int();
+    cp.set_position(position);
+    cp.resize( num_measurements );
+    for ( size_t i = 0; i < num_measurements; i++ ) {
+      size_t cam_id = scanner.read_int();
+      scanner.read_int(); // feature index
+      float x = scanner.read_float();
+      float y = scanner.read_float();
+      cp[i] = ba::ControlMeasure( x, y, 1, 1, cam_id );
+    }
+  }
+
+  // Reads a whole file into memory in large blocks
+  void read_file_buffer( std::string const& file, std::vector<char>& buffer ) {
+    std::ifstream stream( file.c_str(), std::ios::in | std::ios::binary );
+    if ( !stream.is_open() )
+      vw_throw( ArgumentErr() << "Unable to open: " << file << "!\n" );
+    stream.seekg( 0, std::ios::end );
+    size_t size = stream.tellg();
+    stream.seekg( 0, std::ios::beg );
+    buffer.resize( size );
+    const size_t block = 64 << 20;
+    for ( size_t offset = 0; offset < size; offset += block )
+      stream.read( &buffer[offset], std::min( block, size - offset ) );
+    if ( !stream )
+      vw_throw( IOErr() << "Failed reading: " << file << "\n" );
+  }
+
+  // Counts the lines in [begin,end) that are not blank
+  class NVMLineCountTask : public Task {
+    char const *m_begin, *m_end;
+    size_t& m_count;
+  public:
+    NVMLineCountTask( char const* begin, char const* end, size_t& count ) :
+      m_begin(begin), m_end(end), m_count(count) {}
+    virtual ~NVMLineCountTask() {}
+    virtual void operator()() {
+      size_t count = 0;
+      bool content = false;
+      for ( char const* c = m_begin; c < m_end; c++ ) {
+        if ( *c == '\n' ) {
+          if ( content )
+            count++;
+          content = false;
+        } else if ( !NVMTextScanner::is_space( *c ) ) {
+          content = true;
+        }
+      }
+      m_count = count + ( content ? 1 : 0 );
+    }
+  };
+
+  // Parses num points, one per line, from [begin,end) into the
+  // network starting at index first.
+  class NVMPointChunkTask : public Task {
+    char const *m_begin, *m_end;
+    size_t m_first, m_num;
+    ba::ControlNetwork& m_cnet;
+    char& m_failed;
+  public:
+    NVMPointChunkTask( char const* begin, char const* end, size_t first,
+                       size_t num, ba::ControlNetwork& cnet, char& failed ) :
+      m_begin(begin), m_end(end), m_first(first), m_num(num),
+      m_cnet(cnet), m_failed(failed) {}
+    virtual ~NVMPointChunkTask() {}
+    virtual void operator()() {
+      NVMTextScanner scanner( m_begin, m_end );
+      try {
+        for ( size_t i = 0; i < m_num; i++ ) {
+          read_nvm_measurement( scanner, m_cnet[m_first + i] );
+          if ( !scanner.finish_line() ) {
+            m_failed = 1;
+            return;
+          }
+        }
+      } catch ( std::exception const& ) {
+        // Includes bad_alloc and length_error from a malformed measure
+        // count, which would otherwise end the process on this thread
+        m_failed = 1;
+      }
+    }
+  };
+
+  // Parses the point section in parallel. The section is cut into
+  // chunks at line breaks, blank lines are counted per chunk to find
+  // where each chunk's points go, then every chunk fills its part of
+  // the network. Returns false if the section is not one point per
+  // line, in which case the caller should parse it serially.
+  bool read_nvm_points_parallel( char const* begin, char const* end,
+                                 ba::ControlNetwork& cnet, int num_threads ) {
+    size_t num_chunks = num_threads * 4;
+    size_t chunk_size = ( end - begin ) / num_chunks + 1;
+    std::vector<char const*> bounds( 1, begin );
+    while ( bounds.back() < end ) {
+      char const* next = bounds.back() + chunk_size;
+      if ( next >= end ) {
+        next = end;
+      } else {
+        next = static_cast<char const*>( memchr( next, '\n', end - next ) );
+        next = next ? next + 1 : end;
+      }
+      bounds.push_back( next );
+    }
+    num_chunks = bounds.size() - 1;
+
+    std::vector<size_t> counts( num_chunks, 0 );
+    {
+      FifoWorkQueue queue( num_threads );
+      for ( size_t c = 0; c < num_chunks; c++ )
+        queue.add_task( boost::shared_ptr<Task>(
+            new NVMLineCountTask( bounds[c], bounds[c+1], counts[c] ) ) );
+      queue.join_all();
+    }
+
+    std::vector<char> failed( num_chunks, 0 );
+    size_t first = 0;
+    {
+      FifoWorkQueue queue( num_threads );
+      for ( size_t c = 0; c < num_chunks && first < cnet.size(); c++ ) {
+        size_t num = std::min( counts[c], cnet.size() - first );
+        queue.add_task( boost::shared_ptr<Task>(
+            new NVMPointChunkTask( bounds[c], bounds[c+1], first, num,
+                                   cnet, failed[c] ) ) );
+        first += num;
+      }
+      queue.join_all();
+    }
+
+    if ( first < cnet.size() )
+      return false;
+    BOOST_FOREACH( char f, failed )
+      if ( f )
+        return false;
+    return true;
+  }
+
+  // Text NVM in full
+  void read_nvm_text( std::string const& file,
+                      std::vector<NVMBinaryCamera>& cameras,
+                      ba::ControlNetwork& cnet,
+                      int num_threads = vw_settings().default_num_threads() ) {
+    std::vector<char> buffer;
+    read_file_buffer( file, buffer );
+    char const* begin = buffer.empty() ? 0 : &buffer[0];
+    char const* end = begin + buffer.size();
+    NVMTextScanner scanner( begin, end );
+
+    scanner.read_token(); // key
+    cameras.resize( scanner.read_int() );
+    BOOST_FOREACH( NVMBinaryCamera& cam, cameras )
+      read_nvm_camera( scanner, cam );
+
+    // Reading points
+    cnet.resize( scanner.read_int() );
+    if ( num_threads > 1 && cnet.size() > 10000 && scanner.finish_line() &&
+         read_nvm_points_parallel( scanner.position(), end, cnet, num_threads ) )
+      return;
+    BOOST_FOREACH( ba::ControlPoint& cp, cnet ) {
+      read_nvm_measurement( scanner, cp );
+    }
+  }
+
+  // Reference istream reader, kept for comparison in nvm_parse_bench
+  void read_nvm_text_stream( std::string const& file,
+                             std::vector<NVMBinaryCamera>& cameras,
+                             ba::ControlNetwork& cnet ) {
     std::ifstream nvm( file.c_str(), std::ios::in );
     if (!nvm.is_open())
       vw_throw( ArgumentErr() << "Unable to open: " << file << "!\n" );
     std::string key;
     size_t num_cameras;
     nvm >> key >> num_cameras;
-
-    // Allocate memory
-    camera_structure.resize(num_cameras);
-    typedef typename CameraStructT::iterator CIter;
-    for ( CIter camera = camera_structure.begin();
-          camera != camera_structure.end(); camera++ ) {
-      camera->reset( read_nvm_camera(nvm) );
-    }
+    cameras.resize( num_cameras );
+    BOOST_FOREACH( NVMBinaryCamera& cam, cameras )
+      read_nvm_camera( nvm, cam );
 
     // Reading points
     size_t num_pts;
@@ -181,23 +950,70 @@ namespace vw {
     }
   }
 
+  // Loads either NVM format. Text files are converted to a .bnvm
+  // beside them on first read, which later reads use for as long as
+  // it is newer than the text.
+  void read_nvm_data( std::string const& file,
+                      std::vector<NVMBinaryCamera>& cameras,
+                      ba::ControlNetwork& cnet ) {
+    namespace fs = boost::filesystem;
+    if ( is_nvm_binary( file ) ) {
+      NVMBinaryFile( file ).load( cameras, cnet );
+      return;
+    }
+
+    // The companion is only used when it was made from this exact
+    // file. Stamping before the parse means a file that changes while
+    // it is read will not match next time.
+    std::string binary = fs::change_extension( file, ".bnvm" ).string();
+    NVMTextStamp stamp = nvm_text_stamp( file );
+    if ( binary != file && stamp.size && is_nvm_binary( binary ) ) {
+      try {
+        NVMBinaryFile companion( binary );
+        if ( companion.text_stamp() == stamp ) {
+          companion.load( cameras, cnet );
+          return;
+        }
+      } catch ( Exception const& e ) {
+        vw_out(WarningMessage) << "Ignoring binary NVM: " << e.what() << "\n";
+      }
+    }
+
+    read_nvm_text( file, cameras, cnet );
+    if ( binary != file )
+      write_nvm_companion( file, stamp, 0, cameras, cnet );
+  }
+
+  // User reading functions
+  template <class CameraStructT>
+  void read_nvm_iterator_ptr( std::string const& file,
+                              CameraStructT& camera_structure,
+                              ba::ControlNetwork& cnet ) {
+    std::vector<NVMBinaryCamera> cameras;
+    read_nvm_data( file, cameras, cnet );
+
+    camera_structure.resize(cameras.size());
+    typedef typename CameraStructT::iterator CIter;
+    size_t index = 0;
+    for ( CIter camera = camera_structure.begin();
+          camera != camera_structure.end(); camera++ ) {
+      camera->reset( nvm_pinhole( cameras[index++] ) );
+    }
+  }
+
   template <class FocalStructT, class RotStructT, class TStructT>
   void read_nvm_r9t( std::string const& file,
                      FocalStructT& focal_structure,
                      RotStructT& rot_structure,
                      TStructT& trans_structure,
                      ba::ControlNetwork& cnet ) {
-    std::ifstream nvm( file.c_str(), std::ios::in );
-    if (!nvm.is_open())
-      vw_throw( ArgumentErr() << "Unable to open: " << file << "!\n" );
-    std::string key;
-    size_t num_cameras;
-    nvm >> key >> num_cameras;
+    std::vector<NVMBinaryCamera> cameras;
+    read_nvm_data( file, cameras, cnet );
 
     // Allocating memory
-    focal_structure.resize(num_cameras);
-    rot_structure.resize(num_cameras);
-    trans_structure.resize(num_cameras);
+    focal_structure.resize(cameras.size());
+    rot_structure.resize(cameras.size());
+    trans_structure.resize(cameras.size());
 
     // Define iterators
     typedef typename FocalStructT::iterator FIter;
@@ -206,16 +1022,15 @@ namespace vw {
     FIter fbegin = focal_structure.begin();
     RIter rbegin = rot_structure.begin();
     TIter tbegin = trans_structure.begin();
-    while ( fbegin != focal_structure.end() ) {
-      read_nvm_r9t(nvm, *fbegin, *rbegin, *tbegin );
+    BOOST_FOREACH( NVMBinaryCamera const& cam, cameras ) {
+      *fbegin = cam.focal;
+      for ( size_t i = 0; i < 3; i++ ) {
+        for ( size_t j = 0; j < 3; j++ )
+          (*rbegin)(i,j) = cam.rotation[3*i+j];
+        (*tbegin)[i] = cam.translation[i];
+      }
       fbegin++; rbegin++; tbegin++;
     }
-    size_t num_pts;
-    nvm >> num_pts;
-    cnet.resize( num_pts );
-    BOOST_FOREACH( ba::ControlPoint& cp, cnet ) {
-      read_nvm_measurement( nvm, cp );
-    }
   }
 }
 
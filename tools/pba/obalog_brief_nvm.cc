@@ -12,17 +12,21 @@ namespace po = boost::program_options;
 
 #include "../src/camera_fitting.h"
 #include "../src/ApolloShapes.h"
+#include "../src/patch_descriptors.h"
+#include "../src/cache_view.h"
 
 using namespace vw;
 
 int main( int argc, char* argv[] ) {
 
   std::string cam_file, image_file;
+  size_t cache_memory_mb;
   po::options_description general_options("Options");
   general_options.add_options()
     ("cam-file", po::value(&cam_file), "A file listing the input cube files.")
     ("image-file", po::value(&image_file), "Input control network.")
     ("no-linearize", "Don't linearize, create VWIPs that can be used by standard BA.")
+    ("cache-memory", po::value(&cache_memory_mb)->default_value(2048), "Megabytes the rotated image may use in RAM before it is cached to disk instead.")
     ("help,h", "Display this help message");
 
   po::positional_options_description p;
@@ -100,10 +104,10 @@ int main( int argc, char* argv[] ) {
   CompositionTransform<TranslateTransform,RotateTransform>
     trans( TranslateTransform( extension, extension ),
            RotateTransform( rotate, pivot ) );
-  DiskCacheImageView<PixelGray<float> > cache(
+  MemoryCacheImageView<PixelGray<float> > cache(
       crop(transform( image, trans ), 0, 0,
            extension*2+image_size[0],
-           extension*2+image_size[1]), "tif",
+           extension*2+image_size[1]), cache_memory_mb * 1024 * 1024,
       TerminalProgressCallback("","Caching:") );
 
   // OBALOG
@@ -114,18 +118,7 @@ int main( int argc, char* argv[] ) {
   vw_out() << "\tDetected IP: " << ip.size() << "\n";
 
   // BRIEF ( or SGRAD for the time being )
-  ip::SGradDescriptorGenerator gen;
-  BOOST_FOREACH( ip::InterestPoint& pt, ip ) {
-    float scaling = 1.0f / pt.scale;
-    ImageView<PixelGray<float> > patch =
-      transform( cache,
-                 AffineTransform( Matrix2x2( scaling, 0, 0, scaling ),
-                                  Vector2(-scaling*pt.x+20.5,
-                                          -scaling*pt.y+20.5) ),
-                 42, 42 );
-    pt.descriptor.set_size( 180 );
-    gen.compute_descriptor( patch, pt.begin(), pt.end() );
-  }
+  describe_sgrad( cache, ip );
 
   // Transform back to orignal coordinates
   BOOST_FOREACH( ip::InterestPoint& pt, ip ) {
@@ -140,32 +133,16 @@ int main( int argc, char* argv[] ) {
   ApolloShapes shapes;
   BBox2f image_bbox = bounding_box(image);
   image_bbox.contract(1);
-  int32 image_number = extract_camera_number( image_file );
-  for ( ip::InterestPointList::iterator point = ip.begin();
-        point != ip.end(); ++point ) {
+  uint8 frame_shapes =
+    shapes.frame_shapes( extract_camera_number( image_file ) );
+  ip::InterestPointList::iterator point = ip.begin();
+  while ( point != ip.end() ) {
     Vector2f point_loc(point->x,point->y);
-    bool todelete = false;
     if ( !image_bbox.contains( point_loc ) ||
-         shapes.in_fiducial( point_loc ) )
-      todelete = true;
-    if ( image_number == 151944 ||
-         (image_number >= 170233 && image_number <= 170313) ||
-         (image_number >= 171981 && image_number <= 172124) ) {
-      if ( shapes.in_lens_cap( point_loc ) )
-        todelete = true;
-    }
-    if ( (image_number >= 152093 && image_number <= 152204) ||
-         (image_number >= 161145 && image_number <= 161650) ||
-         (image_number >= 161897 && image_number <= 161985) ||
-         (image_number >= 162156 && image_number <= 162845) ) {
-      if ( shapes.in_antenna( point_loc ) )
-        todelete = true;
-    }
-    if ( todelete ) {
+         ( shapes.shapes_at( point_loc ) & frame_shapes ) )
       point = ip.erase(point);
-      point--;
-      continue;
-    }
+    else
+      point++;
   }
 
   if (!vm.count("no-linearize")) {
@@ -7,6 +7,7 @@
 #include <vw/InterestPoint.h>
 #include "Kriging.h"
 #include "ann_matcher.h"
+#include "ip_tracks.h"
 
 using namespace vw;
 
@@ -18,24 +19,25 @@ namespace fs = boost::filesystem;
 std::string left, right;
 float search_scalar, matcher_threshold;
 
+// Removes from subject every IP that has the position of one of the
+// search terms, keeping the order of the rest.
 template <class T>
 void filter_vwip( T& subject, T& search_terms ) {
+  IPKeyIndex found;
+  for ( typename T::const_iterator j = search_terms.begin();
+        j != search_terms.end(); j++ )
+    found.insert( ip_key( 0, j->x, j->y ) );
+
+  typename T::iterator out = subject.begin();
   for ( typename T::iterator i = subject.begin();
         i != subject.end(); i++ ) {
-    bool found = false;
-    for ( typename T::const_iterator j = search_terms.begin();
-          j != search_terms.end(); j++ ) {
-      if ( i->x == j->x && i->y == j->y ) {
-        found = true;
-        break;
-      }
-    }
-
-    if ( found ) {
-      i = subject.erase( i );
-      i--;
-    }
+    if ( found.contains( ip_key( 0, i->x, i->y ) ) )
+      continue;
+    if ( out != i )
+      *out = *i;
+    out++;
   }
+  subject.erase( out, subject.end() );
 }
 
 void do_guided_search() {
@@ -80,6 +82,13 @@ void do_guided_search() {
   }
   ANNkd_tree* kdtree_ispace2 = new ANNkd_tree( ann_pts, vwip_ip2.size(), 2 );
 
+  // Search locations and radii for every unmatched IP in one batch
+  std::vector<Vector2f> inputs, offsets, errors;
+  inputs.reserve( vwip_ip1.size() );
+  BOOST_FOREACH( ip::InterestPoint const& ip, vwip_ip1 )
+    inputs.push_back( Vector2f(ip.x,ip.y) );
+  disparity.error( inputs, offsets, errors );
+
   // Iterate over combinations of the input files and find interest points
   std::vector<int> matched_index( vwip_ip1.size() );
   TerminalProgressCallback tpc("tools", "Matching:");
@@ -87,11 +96,9 @@ void do_guided_search() {
   count = 0;
   BOOST_FOREACH( ip::InterestPoint const& ip, vwip_ip1 ) {
     tpc.report_incremental_progress( inc_amt );
-    Vector2f input(ip.x,ip.y);
-    Vector2f error;
-    Vector2f query = input + disparity.error( ip.x, ip.y, error );
+    Vector2f query = inputs[count] + offsets[count];
 
-    double sqRadius = pow(norm_2(error)*search_scalar,2);
+    double sqRadius = pow(norm_2(errors[count])*search_scalar,2);
     int k = kdtree_ispace2->annkFRSearch( &query[0], sqRadius, 0,
                                           NULL, NULL, 0.0 );
     if ( k < 2 ) {
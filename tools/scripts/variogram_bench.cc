@@ -0,0 +1,85 @@
+// Compares the binned PowVariogram fit against the exhaustive all
+// pairs fit on a synthetic disparity field. Exits with an error if the
+// fitted alpha differs by more than the tolerance.
+
+#include <limits>
+#include <vw/Core.h>
+#include <vw/Math.h>
+#include "Kriging.h"
+using namespace vw;
+
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+
+int main( int argc, char** argv ) {
+  size_t num_samples, max_pairs;
+  double tolerance, beta;
+
+  po::options_description general_options("Options");
+  general_options.add_options()
+    ("samples,n", po::value(&num_samples)->default_value(20000), "Number of synthetic samples.")
+    ("max-pairs", po::value(&max_pairs)->default_value(2000000), "Pair budget for the binned fit.")
+    ("beta", po::value(&beta)->default_value(1.5), "Variogram exponent.")
+    ("tolerance", po::value(&tolerance)->default_value(0.02), "Allowed relative error in alpha.")
+    ("help,h", "Display this help message");
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(general_options).run(), vm );
+    po::notify( vm );
+  } catch (po::error &e) {
+    std::cout << "An error occured while parsing command line arguments.\n";
+    std::cout << "\t" << e.what() << "\n\n";
+    std::cout << general_options << std::endl;
+    return 1;
+  }
+
+  if ( vm.count("help") ) {
+    std::cout << "Usage: " << argv[0] << " [options]\n\n" << general_options << std::endl;
+    return 1;
+  }
+
+  // Smooth disparity over a 10k pixel square with a little noise
+  typedef std::pair<Vector2f, Vector2f> sample_type;
+  std::list<sample_type> samples;
+  uint64 state = 1;
+  for ( size_t i = 0; i < num_samples; i++ ) {
+    float v[3];
+    for ( size_t k = 0; k < 3; k++ ) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      v[k] = float( (state >> 33) % 100000 ) / 100000;
+    }
+    Vector2f loc( v[0] * 10000, v[1] * 10000 );
+    Vector2f disp( 20 * sin( loc[0] / 900 ) + 0.01 * loc[0] + v[2],
+                   15 * cos( loc[1] / 700 ) - 0.02 * loc[1] + v[2] );
+    samples.push_back( sample_type( loc, disp ) );
+  }
+
+  pt::ptime start = pt::microsec_clock::local_time();
+  PowVariogram<Vector2f> exhaustive( samples, beta, 0,
+                                     std::numeric_limits<size_t>::max() );
+  pt::ptime middle = pt::microsec_clock::local_time();
+  PowVariogram<Vector2f> binned( samples, beta, 0, max_pairs );
+  pt::ptime end = pt::microsec_clock::local_time();
+
+  std::cout << "Exhaustive alpha: " << exhaustive.alpha() << " in "
+            << (middle - start).total_milliseconds() << " ms\n";
+  std::cout << "Binned alpha:     " << binned.alpha() << " in "
+            << (end - middle).total_milliseconds() << " ms\n";
+
+  bool success = true;
+  for ( size_t k = 0; k < 2; k++ ) {
+    double error = fabs( binned.alpha()[k] - exhaustive.alpha()[k] ) /
+      fabs( exhaustive.alpha()[k] );
+    std::cout << "Channel " << k << " relative error: " << error << "\n";
+    if ( !(error <= tolerance) )
+      success = false;
+  }
+  if ( !success ) {
+    std::cout << "Binned fit is outside of tolerance " << tolerance << "\n";
+    return 1;
+  }
+  return 0;
+}
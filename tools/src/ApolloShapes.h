@@ -1,8 +1,17 @@
 #ifndef __VW_APOLLO_SHAPES_H__
 #define __VW_APOLLO_SHAPES_H__
 
+#include <vw/Core/Exception.h>
+#include <vw/Core/Thread.h>
+#include <vw/Math/Vector.h>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/polygon/polygon.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <vector>
 
 namespace vw {
 
@@ -54,33 +63,223 @@ namespace vw {
     boost::polygon::construct<Point>(1145,687)
   };
 
+  // Ranges of image numbers (mission*10000 + frame) where the lens cap
+  // or the antenna is visible in the frame. Ranges may overlap.
+  struct ShapeInterval {
+    int32 first, last;
+    const char* shape;
+  };
+  ShapeInterval SHAPE_INTERVALS[] = {
+    { 151941, 151944, "lens_cap" },
+    { 152093, 152097, "lens_cap" },
+    { 170233, 170313, "lens_cap" },
+    { 171981, 172124, "lens_cap" },
+    { 152093, 152204, "antenna" },
+    { 161145, 161650, "antenna" },
+    { 161896, 161985, "antenna" },
+    { 162155, 162845, "antenna" }
+  };
+
+  /// Lookup of which shapes need masking for an image number.
+  ///
+  /// The compiled-in SHAPE_INTERVALS are used unless the
+  /// APOLLO_SHAPE_TABLE enviromental variable points to a file that
+  /// replaces them. That file has one "<shape> <first> <last>" range per
+  /// line where shape is lens_cap or antenna. Lines starting with # are
+  /// ignored.
+  class ApolloShapeTable {
+    // Shapes that apply from the key up until the next key
+    std::map<int32, uint8> m_steps;
+
+  public:
+    enum ShapeFlag { FIDUCIAL = 1, LENS_CAP = 2, ANTENNA = 4 };
+
+    ApolloShapeTable() {
+      if ( std::getenv("APOLLO_SHAPE_TABLE") ) {
+        read( std::getenv("APOLLO_SHAPE_TABLE") );
+        return;
+      }
+      for ( size_t i = 0; i < sizeof(SHAPE_INTERVALS)/sizeof(ShapeInterval); i++ )
+        add( SHAPE_INTERVALS[i].first, SHAPE_INTERVALS[i].last,
+             parse_shape( SHAPE_INTERVALS[i].shape ) );
+    }
+
+    static uint8 parse_shape( std::string const& name ) {
+      if ( name == "lens_cap" )
+        return LENS_CAP;
+      if ( name == "antenna" )
+        return ANTENNA;
+      vw_throw( ArgumentErr() << "Unknown Apollo shape \"" << name << "\"." );
+      return 0;
+    }
+
+    void read( std::string const& filename ) {
+      std::ifstream file( filename.c_str(), std::ifstream::in );
+      if ( !file.is_open() )
+        vw_throw( IOErr() << "Unable to open \"" << filename << "\"." );
+      m_steps.clear();
+      std::string line;
+      while ( std::getline( file, line ) ) {
+        if ( line.empty() || line[0] == '#' )
+          continue;
+        std::istringstream stream( line );
+        std::string shape;
+        int32 first, last;
+        if ( !(stream >> shape >> first >> last) )
+          vw_throw( IOErr() << "Unable to parse \"" << line << "\" in "
+                    << filename << "." );
+        add( first, last, parse_shape( shape ) );
+      }
+    }
+
+    // Enables shapes for every image number in [first, last]
+    void add( int32 first, int32 last, uint8 shapes ) {
+      split( first );
+      split( last + 1 );
+      for ( std::map<int32, uint8>::iterator it = m_steps.find( first );
+            it->first <= last; it++ )
+        it->second |= shapes;
+    }
+
+    // Shapes that apply to an image number, fiducials always do.
+    uint8 shapes( int32 image_number ) const {
+      std::map<int32, uint8>::const_iterator it =
+        m_steps.upper_bound( image_number );
+      if ( it == m_steps.begin() )
+        return FIDUCIAL;
+      it--;
+      return FIDUCIAL | it->second;
+    }
+
+  private:
+    // Makes sure a step starts at key, inheriting the shapes before it.
+    void split( int32 key ) {
+      std::map<int32, uint8>::iterator it = m_steps.upper_bound( key );
+      if ( it != m_steps.begin() ) {
+        std::map<int32, uint8>::iterator prev = it; prev--;
+        if ( prev->first == key )
+          return;
+        m_steps.insert( it, std::make_pair( key, prev->second ) );
+      } else {
+        m_steps.insert( it, std::make_pair( key, uint8(0) ) );
+      }
+    }
+  };
+
+  /// Rasterised copy of the Apollo shapes for one frame resolution.
+  ///
+  /// Pixel (i,j) holds a bit for every shape that contains the point
+  /// (scaling*i, scaling*j) in the 1145 pixel reference frame.
+  class ApolloShapeRaster {
+    int32 m_cols, m_rows;
+    std::vector<uint8> m_flags;
+  public:
+    ApolloShapeRaster( int32 cols, int32 rows ) :
+      m_cols(cols), m_rows(rows), m_flags(size_t(cols)*size_t(rows), 0) {}
+
+    inline int32 cols() const { return m_cols; }
+    inline int32 rows() const { return m_rows; }
+
+    inline uint8& flags( int32 i, int32 j ) { return m_flags[size_t(j)*m_cols + i]; }
+    inline uint8 operator()( int32 i, int32 j ) const {
+      if ( i < 0 || j < 0 || i >= m_cols || j >= m_rows )
+        return 0;
+      return m_flags[size_t(j)*m_cols + i];
+    }
+  };
+
   struct ApolloShapes {
+    enum ShapeFlag { FIDUCIAL = ApolloShapeTable::FIDUCIAL,
+                     LENS_CAP = ApolloShapeTable::LENS_CAP,
+                     ANTENNA  = ApolloShapeTable::ANTENNA };
+    typedef boost::shared_ptr<ApolloShapeRaster const> raster_ptr;
+
     Polygon left_fiducial, top_fiducial, right_fiducial, bot_fiducial;
     Polygon lens_cap, antenna;
 
-    ApolloShapes() {
+    ApolloShapes() : m_cache( new RasterCache ) {
       boost::polygon::set_points(left_fiducial, LEFT_FIDUCIAL, LEFT_FIDUCIAL+3);
       boost::polygon::set_points(top_fiducial,  TOP_FIDUCIAL,  TOP_FIDUCIAL+3);
       boost::polygon::set_points(right_fiducial,RIGHT_FIDUCIAL,RIGHT_FIDUCIAL+3);
       boost::polygon::set_points(bot_fiducial,  BOT_FIDUCIAL,  BOT_FIDUCIAL+3);
       boost::polygon::set_points(lens_cap,      LENS_CAP,      LENS_CAP+14);
       boost::polygon::set_points(antenna,       ANTENNA,       ANTENNA+7);
+      // Built here so shapes_at needs no lock between threads
+      m_reference = raster( 1146, 1146 );
+    }
+
+    // Returns the shapes rasterised for a cols x rows image whose pixels
+    // are scaling units of the reference frame apart. Rasters are built
+    // once per scaling factor and shared by every copy of this object.
+    raster_ptr raster( int32 cols, int32 rows, float scaling = 1.0f ) const {
+      Mutex::Lock lock( m_cache->mutex );
+      std::map<float, raster_ptr>::const_iterator it =
+        m_cache->rasters.find( scaling );
+      if ( it != m_cache->rasters.end() &&
+           it->second->cols() >= cols && it->second->rows() >= rows )
+        return it->second;
+
+      boost::shared_ptr<ApolloShapeRaster> result( new ApolloShapeRaster( cols, rows ) );
+      burn( *result, scaling, left_fiducial,  FIDUCIAL );
+      burn( *result, scaling, top_fiducial,   FIDUCIAL );
+      burn( *result, scaling, right_fiducial, FIDUCIAL );
+      burn( *result, scaling, bot_fiducial,   FIDUCIAL );
+      burn( *result, scaling, lens_cap,       LENS_CAP );
+      burn( *result, scaling, antenna,        ANTENNA );
+      m_cache->rasters[scaling] = result;
+      return result;
+    }
+
+    // All shapes containing p, looked up in the reference frame raster.
+    inline uint8 shapes_at( Vector2f const& p ) const {
+      return (*m_reference)( int32(floor(p[0]+0.5f)), int32(floor(p[1]+0.5f)) );
+    }
+
+    // Shapes that need masking in this frame. Resolve this once per
+    // frame and test points with shapes_at(p) & frame_shapes.
+    inline uint8 frame_shapes( int32 image_number ) const {
+      return m_table.shapes( image_number );
     }
 
     inline bool in_fiducial( Vector2f const& p ) const {
-      Point pc = boost::polygon::construct<Point>(p[0],p[1]);
-      return boost::polygon::contains(left_fiducial, pc) ||
-        boost::polygon::contains(top_fiducial, pc) ||
-        boost::polygon::contains(right_fiducial, pc) ||
-        boost::polygon::contains(bot_fiducial, pc);
+      return shapes_at( p ) & FIDUCIAL;
     }
 
     inline bool in_lens_cap( Vector2f const& p ) const {
-      return boost::polygon::contains(lens_cap, boost::polygon::construct<Point>(p[0],p[1]));
+      return shapes_at( p ) & LENS_CAP;
     }
 
     inline bool in_antenna( Vector2f const& p ) const {
-      return boost::polygon::contains(antenna, boost::polygon::construct<Point>(p[0],p[1]));
+      return shapes_at( p ) & ANTENNA;
+    }
+
+  private:
+    struct RasterCache {
+      Mutex mutex;
+      std::map<float, raster_ptr> rasters;
+    };
+    boost::shared_ptr<RasterCache> m_cache;
+    raster_ptr m_reference;
+    ApolloShapeTable m_table;
+
+    // Sets flag on every pixel whose scaled location is inside
+    // polygon. Only the polygon's bounding box is visited.
+    static void burn( ApolloShapeRaster& raster, float scaling,
+                      Polygon const& polygon, uint8 flag ) {
+      boost::polygon::rectangle_data<float> extent;
+      boost::polygon::extents( extent, polygon );
+      int32 i_min = std::max( int32(floor(boost::polygon::xl(extent)/scaling)), 0 );
+      int32 i_max = std::min( int32(ceil(boost::polygon::xh(extent)/scaling)), raster.cols()-1 );
+      int32 j_min = std::max( int32(floor(boost::polygon::yl(extent)/scaling)), 0 );
+      int32 j_max = std::min( int32(ceil(boost::polygon::yh(extent)/scaling)), raster.rows()-1 );
+      for ( int32 j = j_min; j <= j_max; j++ ) {
+        for ( int32 i = i_min; i <= i_max; i++ ) {
+          if ( boost::polygon::contains( polygon,
+                                         boost::polygon::construct<Point>(scaling*i,
+                                                                          scaling*j) ) )
+            raster.flags(i,j) |= flag;
+        }
+      }
     }
   };
 
@@ -1,121 +1,551 @@
 #ifndef __VW_IMAGE_KRIGING_H__
 #define __VW_IMAGE_KRIGING_H__
 
+#include <deque>
 #include <list>
+#include <map>
 #include <utility>
+#include <algorithm>
+#include <vw/Core/Thread.h>
 #include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Math/BBox.h>
 #include <vw/Math/LinearAlgebra.h>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace vw {
 
   // Variogram Model
   //
   // There could be more of these in the future, however I don't know about them.
+  //
+  // alpha is the least squares fit of 0.5*(y_i-y_j)^2 - nug^2 against
+  // r_ij^beta over every pair of samples. When there are more than
+  // max_pairs pairs, the sums are instead estimated from distance
+  // bins. Pairs closer than a spatial hash cell are all visited. The
+  // rest are drawn at random, with at most a fixed number kept per bin
+  // and each bin reweighted to the number of pairs it represents.
   template <class PixelT>
   class PowVariogram {
     typedef Vector<double,CompoundNumChannels<PixelT>::value> result_type;
     result_type m_alpha;
     double m_beta, m_nugsq;
 
+    inline void add_pair( Vector2f const& p1, PixelT const& v1,
+                          Vector2f const& p2, PixelT const& v2,
+                          result_type& num, double& denum ) const {
+      double rb = norm_2_sqr(p1-p2);
+      rb = pow(rb,0.5*m_beta);
+      for ( size_t k = 0; k < CompoundNumChannels<PixelT>::value; k++ )
+        num[k] += rb*(0.5*pow(v1[k]-v2[k],2) - m_nugsq);
+      denum += pow(rb,2);
+    }
+
+    void estimate_sums( std::vector<Vector2f> const& pos,
+                        std::vector<PixelT> const& val, size_t max_pairs,
+                        result_type& num, double& denum ) const {
+      const size_t num_bins = 32;
+      const double near_neighbors = 16;
+      size_t n = pos.size();
+
+      BBox2f bbox;
+      BOOST_FOREACH( Vector2f const& p, pos )
+        bbox.grow( p );
+      double diagonal = norm_2( bbox.size() );
+      if ( diagonal == 0 )
+        return;
+
+      // Spatial hash sized so that a point sees about near_neighbors
+      // other points in the surrounding 3x3 cells.
+      double cell = std::max( diagonal * sqrt( near_neighbors / (18.0 * n) ),
+                              diagonal / 4096 );
+      int32 hash_cols = int32( bbox.width()  / cell ) + 1;
+      int32 hash_rows = int32( bbox.height() / cell ) + 1;
+      std::map<int32, std::vector<size_t> > hash;
+      std::vector<int32> hx(n), hy(n);
+      for ( size_t i = 0; i < n; i++ ) {
+        hx[i] = std::min( int32( (pos[i][0] - bbox.min()[0]) / cell ), hash_cols - 1 );
+        hy[i] = std::min( int32( (pos[i][1] - bbox.min()[1]) / cell ), hash_rows - 1 );
+        hash[ hx[i] + hy[i] * hash_cols ].push_back( i );
+      }
+
+      // Every pair closer than cell is found in the 3x3 block
+      double cell_sqr = cell * cell;
+      size_t near_pairs = 0;
+      for ( size_t i = 0; i < n; i++ ) {
+        for ( int32 dy = -1; dy <= 1; dy++ ) {
+          for ( int32 dx = -1; dx <= 1; dx++ ) {
+            int32 x = hx[i] + dx, y = hy[i] + dy;
+            if ( x < 0 || y < 0 || x >= hash_cols || y >= hash_rows )
+              continue;
+            std::map<int32, std::vector<size_t> >::const_iterator bucket =
+              hash.find( x + y * hash_cols );
+            if ( bucket == hash.end() )
+              continue;
+            BOOST_FOREACH( size_t j, bucket->second ) {
+              if ( j <= i || norm_2_sqr(pos[i]-pos[j]) >= cell_sqr )
+                continue;
+              add_pair( pos[i], val[i], pos[j], val[j], num, denum );
+              near_pairs++;
+            }
+          }
+        }
+      }
+
+      // Remaining pairs are drawn uniformly. Draws past a bin's cap
+      // still count towards how many pairs that bin represents.
+      size_t per_bin = std::max( size_t(1), 2 * max_pairs / num_bins );
+      std::vector<result_type> bin_num( num_bins, result_type() );
+      std::vector<double> bin_denum( num_bins, 0 );
+      std::vector<size_t> drawn( num_bins, 0 ), kept( num_bins, 0 );
+      size_t total_drawn = 0;
+      uint64 state = 0x853c49e6748fea9bULL;
+      for ( size_t attempt = 0; attempt < 2 * max_pairs && total_drawn < max_pairs;
+            attempt++ ) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t i = size_t( (state >> 33) % n );
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t j = size_t( (state >> 33) % n );
+        if ( i == j )
+          continue;
+        double d_sqr = norm_2_sqr(pos[i]-pos[j]);
+        if ( d_sqr < cell_sqr )
+          continue;
+        size_t b = std::min( size_t( sqrt(d_sqr) / diagonal * num_bins ),
+                             num_bins - 1 );
+        drawn[b]++;
+        total_drawn++;
+        if ( kept[b] >= per_bin )
+          continue;
+        add_pair( pos[i], val[i], pos[j], val[j], bin_num[b], bin_denum[b] );
+        kept[b]++;
+      }
+      if ( total_drawn == 0 )
+        return;
+
+      double far_pairs = double(n) * double(n-1) / 2 - double(near_pairs);
+      for ( size_t b = 0; b < num_bins; b++ ) {
+        if ( kept[b] == 0 )
+          continue;
+        double weight = far_pairs * double(drawn[b]) / double(total_drawn) /
+          double(kept[b]);
+        num += weight * bin_num[b];
+        denum += weight * bin_denum[b];
+      }
+    }
+
   public:
     PowVariogram( std::list<std::pair<Vector2f, PixelT> > const& samples,
-                  double beta = 1.5, double nug = 0) :
+                  double beta = 1.5, double nug = 0,
+                  size_t max_pairs = 2000000 ) :
       m_beta(beta), m_nugsq( nug*nug), m_alpha(CompoundNumChannels<PixelT>::value) {
       size_t m_ndim = CompoundNumChannels<PixelT>::value;
       typedef std::pair<Vector2f, PixelT> pair_list;
-      typedef std::list<pair_list > sample_type;
-      result_type num(m_ndim), denum(m_ndim);
-      for ( typename sample_type::const_iterator i = samples.begin();
-            i != samples.end(); i++ ) {
-        typename sample_type::const_iterator j = i; j++;
-        for ( ; j != samples.end(); j++ ) {
-          double rb = norm_2_sqr(i->first-j->first);
-          rb = pow(rb,0.5*m_beta);
-          for ( size_t k = 0; k < m_ndim; k++ ) {
-            num[k] += rb*(0.5*pow(i->second[k]-j->second[k],2) - m_nugsq);
-            denum[k] += pow(rb,2);
-          }
-        }
+      std::vector<Vector2f> pos;
+      std::vector<PixelT> val;
+      pos.reserve( samples.size() );
+      val.reserve( samples.size() );
+      BOOST_FOREACH( pair_list const& sample, samples ) {
+        pos.push_back( sample.first );
+        val.push_back( sample.second );
+      }
+
+      size_t n = pos.size();
+      result_type num(m_ndim);
+      double denum = 0;
+      if ( n < 2 || n*(n-1)/2 <= max_pairs ) {
+        for ( size_t i = 0; i < n; i++ )
+          for ( size_t j = i + 1; j < n; j++ )
+            add_pair( pos[i], val[i], pos[j], val[j], num, denum );
+      } else {
+        estimate_sums( pos, val, max_pairs, num, denum );
       }
       for ( size_t k = 0; k < m_ndim; k++ )
-        m_alpha[k] = num[k]/denum[k];
+        m_alpha[k] = num[k]/denum;
     }
 
     result_type operator()(const double r) const {
       return elem_sum(m_alpha*pow(r,m_beta),m_nugsq);
     }
+
+    result_type const& alpha() const { return m_alpha; }
+    double beta() const { return m_beta; }
+    double nugget_sq() const { return m_nugsq; }
   };
 
 
+  /// Kriging Sample Grid
+  ///
+  /// Uniform bucket grid over sample locations, used to find the k
+  /// nearest samples to a location without visiting every sample.
+  class KrigingSampleGrid {
+    std::vector<Vector2f> m_positions;
+    BBox2f m_bbox;
+    float m_bucket_size;
+    int32 m_cols, m_rows;
+    std::vector<std::vector<size_t> > m_buckets;
+
+    inline int32 clamp( int32 v, int32 size ) const {
+      return std::min( std::max( v, 0 ), size - 1 );
+    }
+
+  public:
+    KrigingSampleGrid( std::vector<Vector2f> const& positions,
+                       size_t per_bucket = 8 ) : m_positions(positions) {
+      BOOST_FOREACH( Vector2f const& p, positions )
+        m_bbox.grow( p );
+      float area = std::max( m_bbox.width() * m_bbox.height(), 1.0f );
+      m_bucket_size =
+        std::max( float( sqrt( area * per_bucket / float(positions.size()) ) ), 1.0f );
+      m_cols = int32( m_bbox.width() / m_bucket_size ) + 1;
+      m_rows = int32( m_bbox.height() / m_bucket_size ) + 1;
+      m_buckets.resize( m_cols * m_rows );
+      for ( size_t i = 0; i < positions.size(); i++ )
+        m_buckets[ bucket_x( positions[i][0] ) +
+                   bucket_y( positions[i][1] ) * m_cols ].push_back( i );
+    }
+
+    inline int32 bucket_x( float x ) const {
+      return clamp( int32( floor( (x - m_bbox.min()[0]) / m_bucket_size ) ), m_cols );
+    }
+    inline int32 bucket_y( float y ) const {
+      return clamp( int32( floor( (y - m_bbox.min()[1]) / m_bucket_size ) ), m_rows );
+    }
+
+    // Indices of the k samples closest to query, in ascending order
+    // of index.
+    void knn( Vector2f const& query, size_t k,
+              std::vector<size_t>& result ) const {
+      typedef std::pair<float, size_t> candidate;
+      std::vector<candidate> candidates;
+      int32 qx = bucket_x( query[0] ), qy = bucket_y( query[1] );
+      int32 max_ring = std::max( m_cols, m_rows );
+      for ( int32 ring = 0; ring <= max_ring; ring++ ) {
+        for ( int32 y = qy - ring; y <= qy + ring; y++ ) {
+          if ( y < 0 || y >= m_rows )
+            continue;
+          bool edge_row = y == qy - ring || y == qy + ring;
+          for ( int32 x = qx - ring; x <= qx + ring;
+                x += edge_row ? 1 : 2*ring ) {
+            if ( x >= 0 && x < m_cols ) {
+              BOOST_FOREACH( size_t i, m_buckets[x + y * m_cols] )
+                candidates.push_back( candidate( norm_2_sqr( m_positions[i] - query ), i ) );
+            }
+            if ( ring == 0 )
+              break;
+          }
+        }
+
+        // Anything in an unvisited ring is at least ring buckets away
+        if ( candidates.size() >= k ) {
+          std::nth_element( candidates.begin(), candidates.begin() + (k-1),
+                            candidates.end() );
+          float bound = ring * m_bucket_size;
+          if ( candidates[k-1].first <= bound * bound )
+            break;
+        }
+      }
+
+      size_t count = std::min( k, candidates.size() );
+      std::sort( candidates.begin(), candidates.end() );
+      result.resize( count );
+      for ( size_t i = 0; i < count; i++ )
+        result[i] = candidates[i].second;
+      std::sort( result.begin(), result.end() );
+    }
+  };
+
   /// Kriging View
   ///
   /// This view renders scatter point data into a single image.
   /// Scatter data is provided with std::list<std::pair<Vector2f,T> >.
   /// Where T is the output pixel type.
   ///
+  /// By default every sample takes part in a single global solve. When
+  /// a neighbor count is given, each cell_size square of the output
+  /// instead solves the system for the nearest samples to its center.
+  /// Those local solves are cached per cell, oldest first out once the
+  /// cache holds cache_mb worth of them. With neighbors >= number of
+  /// samples the global solve is used, so results are identical.
+  ///
   /// Largely inspired by p146 of Numerical Recipes: Third Edition
   template <class PixelT>
   class KrigingView : public ImageViewBase<KrigingView<PixelT> > {
-    std::list<std::pair<Vector2f, PixelT> > m_samples;
+
+    // Kriging system solved for a subset of the samples. The sample
+    // positions and weights are also kept as flat arrays so whole rows
+    // of pixels can be evaluated in tight loops. V^-1 is (npt+1)^2 per
+    // channel and only the error surface needs it, so it is built the
+    // first time inverse() is asked for.
+    struct KrigingModel {
+      std::vector<size_t> index;
+      std::vector<Vector<float> > inv_v_y;
+      mutable Mutex inverse_mutex;
+      mutable std::vector<Matrix<float> > inverse;
+      std::vector<float> x, y;
+      std::vector<std::vector<float> > weight; // inv_v_y without the last term
+      std::vector<float> weight_const;         // nugget and last term of inv_v_y
+    };
+    typedef boost::shared_ptr<KrigingModel const> model_ptr;
+
+    struct ModelCache {
+      Mutex mutex;
+      std::map<std::pair<int32,int32>, model_ptr> models;
+      std::deque<std::pair<int32,int32> > order; // Insertion order, for eviction
+    };
+
+    std::vector<Vector2f> m_positions;
+    std::vector<PixelT> m_values;
     size_t m_npt, m_ndim;
     BBox2i m_region;
     PowVariogram<PixelT> m_variogram;
-    std::vector<Vector<float> > m_inv_v_y;
-    std::vector<boost::shared_ptr<math::LUD<float> > > m_lud;
+    model_ptr m_global;
+    size_t m_neighbors;
+    int32 m_cell_size;
+    boost::shared_ptr<KrigingSampleGrid> m_grid;
+    boost::shared_ptr<ModelCache> m_cache;
+    size_t m_cache_limit;
 
-  public:
-    typedef PixelT pixel_type;
-    typedef PixelT result_type;
-    typedef ProceduralPixelAccessor<KrigingView<PixelT> > pixel_accessor;
+    // The variogram system V over the samples in index
+    void build_v( std::vector<size_t> const& index,
+                  std::vector<Matrix<float> >& v ) const {
+      size_t npt = index.size();
+      v.resize(m_ndim);
+      for ( size_t k = 0; k < m_ndim; k++ )
+        v[k].set_size(npt+1,npt+1);
+      for ( size_t i = 0; i < npt; i++ ) {
+        for ( size_t j = i + 1; j < npt; j++ ) {
+          Vector<float> variogram =
+            m_variogram(norm_2(m_positions[index[i]] - m_positions[index[j]]));
+          for ( size_t k = 0; k < m_ndim; k++ )
+            v[k](i,j) = v[k](j,i) = variogram[k];
+        }
+        for ( size_t k = 0; k < m_ndim; k++ )
+          v[k](i,npt) = v[k](npt,i) = 1.0;
+      }
+      for ( size_t k = 0; k < m_ndim; k++ )
+        v[k](npt,npt) = 0.0;
+    }
 
-    KrigingView( std::list<std::pair<Vector2f, PixelT> > const& samples,
-                 BBox2i const& region ) :
-      m_samples(samples), m_npt( samples.size() ),
-      m_ndim( CompoundNumChannels<PixelT>::value ),
-      m_region(region), m_variogram(samples), m_inv_v_y( m_ndim ) {
+    model_ptr build_model( std::vector<size_t> const& index ) const {
+      boost::shared_ptr<KrigingModel> model( new KrigingModel );
+      model->index = index;
+      size_t npt = index.size();
 
-      // Allocating
-      std::vector<Matrix<float> > v(m_ndim);
+      std::vector<Matrix<float> > v;
+      build_v( index, v );
       std::vector<Vector<float> > y(m_ndim);
       for ( size_t k = 0; k < m_ndim; k++ ) {
-        v[k].set_size(m_npt+1,m_npt+1);
-        y[k].set_size(m_npt+1);
+        y[k].set_size(npt+1);
+        for ( size_t i = 0; i < npt; i++ )
+          y[k][i] = m_values[index[i]][k];
+        y[k][npt] = 0.0;
       }
 
-      // Building both y and v
-      typedef std::list<std::pair<Vector2f, PixelT> > sample_type;
-      size_t i_index = 0, j_index;
-      for ( typename sample_type::const_iterator i = m_samples.begin();
-            i != m_samples.end(); i++ ) {
-        for ( size_t k = 0; k < m_ndim; k++ )
-          y[k][i_index] = i->second[k];
+      model->inv_v_y.resize( m_ndim );
+      for ( size_t k = 0; k < m_ndim; k++ )
+        model->inv_v_y[k] = math::LUD<float>( v[k] ).solve( y[k] );
 
-        j_index = i_index + 1;
-        typename sample_type::const_iterator j = i; j++;
-        for ( ; j != m_samples.end(); j++ ) {
-          Vector<float> variogram = m_variogram(norm_2(i->first - j->first));
-          for ( size_t k = 0; k < m_ndim; k++ )
-            v[k](i_index,j_index) = v[k](j_index,i_index) =
-              variogram[k];
-          j_index++;
+      // Flat copies for evaluate_run
+      model->x.resize( npt );
+      model->y.resize( npt );
+      for ( size_t i = 0; i < npt; i++ ) {
+        model->x[i] = m_positions[index[i]][0];
+        model->y[i] = m_positions[index[i]][1];
+      }
+      model->weight.resize( m_ndim );
+      model->weight_const.resize( m_ndim );
+      for ( size_t k = 0; k < m_ndim; k++ ) {
+        model->weight[k].resize( npt );
+        float sum = 0;
+        for ( size_t i = 0; i < npt; i++ ) {
+          model->weight[k][i] = model->inv_v_y[k][i];
+          sum += model->inv_v_y[k][i];
         }
+        model->weight_const[k] =
+          m_variogram.nugget_sq() * sum + model->inv_v_y[k][npt];
+      }
+      return model;
+    }
+
+    // V^-1 of m, solved the first time it is needed
+    std::vector<Matrix<float> > const& inverse( KrigingModel const& m ) const {
+      Mutex::Lock lock( m.inverse_mutex );
+      if ( m.inverse.empty() ) {
+        size_t npt = m.index.size();
+        std::vector<Matrix<float> > v;
+        build_v( m.index, v );
+        Matrix<float> identity( npt+1, npt+1 );
+        for ( size_t i = 0; i < npt+1; i++ )
+          identity(i,i) = 1;
+        m.inverse.resize( m_ndim );
         for ( size_t k = 0; k < m_ndim; k++ )
-          v[k](i_index,m_npt) = v[k](m_npt,i_index) = 1.0;
-        i_index++;
+          m.inverse[k] = math::LUD<float>( v[k] ).solve( identity );
       }
+      return m.inverse;
+    }
+
+    // Returns the system to use at xstar (relative to m_region). Local
+    // systems may be evicted from the cache, so hold on to the pointer
+    // for as long as the system is used.
+    model_ptr model( Vector2f const& xstar ) const {
+      if ( m_global )
+        return m_global;
+
+      std::pair<int32,int32> cell( int32( floor( xstar[0] / m_cell_size ) ),
+                                   int32( floor( xstar[1] / m_cell_size ) ) );
+      {
+        Mutex::Lock lock( m_cache->mutex );
+        typename std::map<std::pair<int32,int32>, model_ptr>::const_iterator it =
+          m_cache->models.find( cell );
+        if ( it != m_cache->models.end() )
+          return it->second;
+      }
+
+      // Solve outside of the lock, other threads may race us here
+      std::vector<size_t> index;
+      m_grid->knn( Vector2f( (cell.first  + 0.5f) * m_cell_size,
+                             (cell.second + 0.5f) * m_cell_size ),
+                   m_neighbors, index );
+      model_ptr solved = build_model( index );
+      Mutex::Lock lock( m_cache->mutex );
+      std::pair<typename std::map<std::pair<int32,int32>, model_ptr>::iterator, bool> result =
+        m_cache->models.insert( std::make_pair( cell, solved ) );
+      if ( result.second ) {
+        m_cache->order.push_back( cell );
+        while ( m_cache->order.size() > m_cache_limit ) {
+          m_cache->models.erase( m_cache->order.front() );
+          m_cache->order.pop_front();
+        }
+      }
+      return result.first->second;
+    }
+
+    // Fills vstar with the variogram between xstar and the model's samples
+    inline void variogram_row( KrigingModel const& model, Vector2f const& xstar,
+                               Matrix<float>& vstar ) const {
+      size_t npt = model.index.size();
+      vstar.set_size( m_ndim, npt+1 );
+      for ( size_t i = 0; i < npt; i++ )
+        select_col(vstar,i) = m_variogram(norm_2(xstar-m_positions[model.index[i]]));
+      for ( size_t k = 0; k < m_ndim; k++ )
+        vstar(k,npt) = 1;
+    }
+
+    // Kriges a batch of queries (relative to m_region) that all use
+    // model m. V* for the batch is one matrix per channel, so the error
+    // terms V*^T V^-1 V* come from a single matrix product.
+    void error_batch( KrigingModel const& m, std::vector<Vector2f> const& xstar,
+                      std::vector<size_t> const& which,
+                      std::vector<result_type>& results,
+                      std::vector<result_type>& errors ) const {
+      size_t npt = m.index.size(), nq = which.size();
+      Matrix<float> power( nq, npt ), vstar( nq, npt+1 );
+      for ( size_t q = 0; q < nq; q++ )
+        for ( size_t i = 0; i < npt; i++ )
+          power(q,i) = pow( norm_2(xstar[which[q]]-m_positions[m.index[i]]),
+                            m_variogram.beta() );
+
       for ( size_t k = 0; k < m_ndim; k++ ) {
-        v[k](m_npt,m_npt) = 0.0;
-        y[k][m_npt] = 0.0;
+        float alpha = m_variogram.alpha()[k];
+        float nugsq = m_variogram.nugget_sq();
+        for ( size_t q = 0; q < nq; q++ ) {
+          for ( size_t i = 0; i < npt; i++ )
+            vstar(q,i) = alpha * power(q,i) + nugsq;
+          vstar(q,npt) = 1;
+        }
+
+        Matrix<float> product = vstar * inverse( m )[k];
+        for ( size_t q = 0; q < nq; q++ ) {
+          results[which[q]][k] = dot_prod(select_row(vstar,q),m.inv_v_y[k]);
+          errors[which[q]][k] =
+            sqrt( dot_prod(select_row(vstar,q),select_row(product,q)) );
+          if ( std::isnan(errors[which[q]][k]) )
+            errors[which[q]][k] = 0;
+        }
+      }
+    }
+
+    // Evaluates count pixels along a row starting at xstar (relative to
+    // m_region) that all use model m. The variogram power term for the
+    // whole run is computed first as a count x npt matrix, which is then
+    // multiplied against each channel's weights.
+    inline void evaluate_run( KrigingModel const& m, Vector2f const& xstar,
+                              int32 count, std::vector<float>& power,
+                              PixelT* out ) const {
+      size_t npt = m.x.size();
+      if ( npt == 0 ) {
+        for ( int32 c = 0; c < count; c++ )
+          for ( size_t k = 0; k < m_ndim; k++ )
+            out[c][k] = m.weight_const[k];
+        return;
+      }
+
+      // r^beta written as exp(beta/2 * log(r^2)) so the loop vectorizes
+      float half_beta = 0.5f * m_variogram.beta();
+      power.resize( size_t(count) * npt );
+      float const* sx = &m.x[0];
+      float const* sy = &m.y[0];
+      for ( int32 c = 0; c < count; c++ ) {
+        float* p = &power[c * npt];
+        float px = xstar[0] + c, py = xstar[1];
+        for ( size_t i = 0; i < npt; i++ ) {
+          float dx = px - sx[i], dy = py - sy[i];
+          p[i] = std::exp( half_beta * std::log( dx*dx + dy*dy ) );
+        }
       }
 
-      // Constructing LUD
-      typedef boost::shared_ptr<math::LUD<float> > lud_ptr;
       for ( size_t k = 0; k < m_ndim; k++ ) {
-        m_lud.push_back( lud_ptr( new math::LUD<float>(v[k]) ) );
-        m_inv_v_y[k] = m_lud[k]->solve( y[k] );
+        float const* w = &m.weight[k][0];
+        float alpha = m_variogram.alpha()[k];
+        for ( int32 c = 0; c < count; c++ ) {
+          float const* p = &power[c * npt];
+          float sum = 0;
+          for ( size_t i = 0; i < npt; i++ )
+            sum += p[i] * w[i];
+          out[c][k] = alpha * sum + m.weight_const[k];
+        }
+      }
+    }
+
+  public:
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef ProceduralPixelAccessor<KrigingView<PixelT> > pixel_accessor;
+
+    KrigingView( std::list<std::pair<Vector2f, PixelT> > const& samples,
+                 BBox2i const& region, size_t neighbors = 0,
+                 int32 cell_size = 32, size_t cache_mb = 128 ) :
+      m_npt( samples.size() ), m_ndim( CompoundNumChannels<PixelT>::value ),
+      m_region(region), m_variogram(samples), m_neighbors(neighbors),
+      m_cell_size(cell_size), m_cache_limit(0) {
+      typedef std::pair<Vector2f, PixelT> sample_type;
+      m_positions.reserve( m_npt );
+      m_values.reserve( m_npt );
+      BOOST_FOREACH( sample_type const& sample, samples ) {
+        m_positions.push_back( sample.first );
+        m_values.push_back( sample.second );
+      }
+
+      if ( m_neighbors == 0 || m_neighbors >= m_npt ) {
+        std::vector<size_t> index( m_npt );
+        for ( size_t i = 0; i < m_npt; i++ )
+          index[i] = i;
+        m_global = build_model( index );
+      } else {
+        m_grid.reset( new KrigingSampleGrid( m_positions ) );
+        m_cache.reset( new ModelCache );
+
+        // Index, positions and weights of each cached system. Never
+        // fewer than two rows of cells, so a row of output does not
+        // evict the systems it is about to reuse.
+        size_t model_bytes =
+          m_neighbors * ( sizeof(size_t) + ( 2 + 2 * m_ndim ) * sizeof(float) );
+        size_t row_cells = m_region.width() / m_cell_size + 2;
+        m_cache_limit = std::max( ( cache_mb << 20 ) / model_bytes, 2 * row_cells );
       }
     }
 
@@ -128,19 +558,9 @@ namespace vw {
     inline result_type operator() (float i, float j, int32 p = 0) const {
       Vector2f xstar(i,j);
       xstar -= m_region.min();
-      Matrix<float> vstar(m_ndim,m_npt+1);
-      typedef std::list<std::pair<Vector2f, PixelT> > sample_type;
-      size_t i_index = 0;
-      for ( typename sample_type::const_iterator i = m_samples.begin();
-            i != m_samples.end(); i++ ) {
-        select_col(vstar,i_index) = m_variogram(norm_2(xstar-i->first));
-        i_index++;
-      }
-      for ( size_t k = 0; k < m_ndim; k++ )
-        vstar(k,m_npt) = 1;
+      std::vector<float> power;
       result_type result;
-      for ( size_t k = 0; k < m_ndim; k++ )
-        result[k] = dot_prod(select_row(vstar,k),m_inv_v_y[k]);
+      evaluate_run( *model( xstar ), xstar, 1, power, &result );
       return result;
     }
 
@@ -149,34 +569,79 @@ namespace vw {
     inline result_type error( float i, float j, result_type& err ) const {
       Vector2f xstar(i,j);
       xstar -= m_region.min();
-      Matrix<float> vstar(m_ndim,m_npt+1);
-      typedef std::list<std::pair<Vector2f, PixelT> > sample_type;
-      size_t i_index = 0;
-      for ( typename sample_type::const_iterator i = m_samples.begin();
-            i != m_samples.end(); i++ ) {
-        select_col(vstar,i_index) = m_variogram(norm_2(xstar-i->first));
-        i_index++;
-      }
-      for ( size_t k = 0; k < m_ndim; k++ )
-        vstar(k,m_npt) = 1;
+      model_ptr m_ptr = model( xstar );
+      KrigingModel const& m = *m_ptr;
+      Matrix<float> vstar;
+      variogram_row( m, xstar, vstar );
       result_type result;
       for ( size_t k = 0; k < m_ndim; k++ )
-        result[k] = dot_prod(select_row(vstar,k),m_inv_v_y[k]);
+        result[k] = dot_prod(select_row(vstar,k),m.inv_v_y[k]);
 
       // Calculating sqrt( V* dot V-1 dot V* )
       for ( size_t k = 0; k < m_ndim; k++ ) {
         err[k] = sqrt( dot_prod(select_row(vstar,k),
-                                m_lud[k]->solve( select_row(vstar,k) ) ) );
+                                inverse( m )[k] * select_row(vstar,k) ) );
         if ( std::isnan(err[k]) )
           err[k] = 0;
       }
       return result;
     }
 
-    typedef KrigingView prerasterize_type;
-    inline prerasterize_type prerasterize( BBox2i const& /*bbox*/ ) const {
-      return *this;
+    // Batched version of error() for many query locations. Queries are
+    // grouped by model and handled block_size at a time.
+    void error( std::vector<Vector2f> const& queries,
+                std::vector<result_type>& results,
+                std::vector<result_type>& errors,
+                size_t block_size = 1024 ) const {
+      results.resize( queries.size() );
+      errors.resize( queries.size() );
+      std::vector<Vector2f> xstar( queries.size() );
+      std::map<model_ptr, std::vector<size_t> > groups;
+      for ( size_t q = 0; q < queries.size(); q++ ) {
+        xstar[q] = queries[q] - m_region.min();
+        groups[ model( xstar[q] ) ].push_back( q );
+      }
+
+      typedef std::pair<model_ptr const, std::vector<size_t> > group_type;
+      std::vector<size_t> block;
+      BOOST_FOREACH( group_type const& group, groups ) {
+        for ( size_t start = 0; start < group.second.size(); start += block_size ) {
+          size_t end = std::min( start + block_size, group.second.size() );
+          block.assign( group.second.begin() + start, group.second.begin() + end );
+          error_batch( *group.first, xstar, block, results, errors );
+        }
+      }
+    }
+
+    /// \cond INTERNAL
+    // Evaluates the whole bbox row by row. In local mode each row is
+    // broken into runs that share a cell.
+    typedef CropView<ImageView<PixelT> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      ImageView<PixelT> buf( bbox.width(), bbox.height() );
+      std::vector<float> power;
+      for ( int32 j = 0; j < bbox.height(); j++ ) {
+        int32 i = 0;
+        while ( i < bbox.width() ) {
+          Vector2f xstar( bbox.min().x() + i - m_region.min().x(),
+                          bbox.min().y() + j - m_region.min().y() );
+          int32 run = bbox.width() - i;
+          if ( !m_global ) {
+            int32 cell_end =
+              (int32( floor( xstar[0] / m_cell_size ) ) + 1) * m_cell_size;
+            run = std::min( run, cell_end - int32( xstar[0] ) );
+          }
+          evaluate_run( *model( xstar ), xstar, run, power, &buf(i,j) );
+          i += run;
+        }
+      }
+      return prerasterize_type( buf, BBox2i(-bbox.min().x(),-bbox.min().y(),
+                                            cols(),rows()) );
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
     }
+    /// \endcond
   };
 
   template <class PixelT>
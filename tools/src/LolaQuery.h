@@ -316,33 +316,36 @@ namespace vw {
       }
     }
 
+    // Index of the tile that contains lonlat. Negative longitudes are
+    // wrapped into the 0-360 range of the tiles.
+    size_t find_index( Vector2 lonlat ) const {
+      if ( lonlat[0] < 0 )
+        lonlat[0] += 360;
+      for ( size_t i = 0; i < m_bboxes.size(); i++ ) {
+        if ( m_bboxes[i].contains( lonlat ) )
+          return i;
+      }
+      vw_throw( ArgumentErr() << "Unable to find match?" );
+      return 0;
+    }
+
+    std::string const& filename( size_t index ) const {
+      return m_filenames[index];
+    }
+
     std::pair<cartography::GeoReference, std::string>
     find_tile( Vector2 lonlat ) {
+      size_t i = find_index( lonlat );
+      std::pair<cartography::GeoReference, std::string> result;
+      cartography::read_georeference( result.first,
+                                      m_filenames[i] );
       if ( lonlat[0] < 0 ) {
-        for ( size_t i = 0; i < m_bboxes.size(); i++ ) {
-          if ( m_bboxes[i].contains( lonlat + Vector2(360,0) ) ) {
-            std::pair<cartography::GeoReference, std::string> result;
-            cartography::read_georeference( result.first,
-                                            m_filenames[i] );
-            Matrix3x3 tx = result.first.transform();
-            tx(0,2) -= 360;
-            result.first.set_transform(tx);
-            result.second = m_filenames[i];
-            return result;
-          }
-        }
-      } else {
-        for ( size_t i = 0; i < m_bboxes.size(); i++ ) {
-          if ( m_bboxes[i].contains( lonlat ) ) {
-            std::pair<cartography::GeoReference, std::string> result;
-            cartography::read_georeference( result.first,
-                                            m_filenames[i] );
-            result.second = m_filenames[i];
-            return result;
-          }
-        }
+        Matrix3x3 tx = result.first.transform();
+        tx(0,2) -= 360;
+        result.first.set_transform(tx);
       }
-      vw_throw( ArgumentErr() << "Unable to find match?" );
+      result.second = m_filenames[i];
+      return result;
     }
 
     std::pair<cartography::GeoReference, std::string>
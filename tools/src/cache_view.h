@@ -0,0 +1,81 @@
+#ifndef __CACHE_VIEW_H__
+#define __CACHE_VIEW_H__
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/FileIO/DiskImageView.h>
+
+namespace vw {
+
+  /// Memory Cache Image View
+  ///
+  /// Rasterizes a view once and keeps the result around for repeated
+  /// access. When the raster fits inside the supplied memory budget it
+  /// is held in RAM. Otherwise it falls back to a DiskCacheImageView,
+  /// which spills to a tiled temporary file.
+  template <class PixelT>
+  class MemoryCacheImageView : public ImageViewBase<MemoryCacheImageView<PixelT> > {
+    boost::shared_ptr<ImageView<PixelT> > m_memory;
+    boost::shared_ptr<DiskCacheImageView<PixelT> > m_disk;
+
+  public:
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef ProceduralPixelAccessor<MemoryCacheImageView<PixelT> > pixel_accessor;
+
+    template <class ViewT>
+    MemoryCacheImageView( ImageViewBase<ViewT> const& view,
+                          size_t budget_bytes,
+                          ProgressCallback const& progress = ProgressCallback::dummy_instance() ) {
+      ViewT const& v = view.impl();
+      size_t required =
+        size_t(v.cols()) * size_t(v.rows()) * size_t(v.planes()) * sizeof(PixelT);
+      if ( required <= budget_bytes ) {
+        progress.report_progress(0);
+        m_memory.reset( new ImageView<PixelT>( v.cols(), v.rows(), v.planes() ) );
+        *m_memory = block_rasterize( v, Vector2i( vw_settings().default_tile_size(),
+                                                  vw_settings().default_tile_size() ) );
+        progress.report_finished();
+      } else {
+        vw_out(DebugMessage,"image") << "MemoryCacheImageView: " << required
+                                     << " bytes exceeds budget, caching to disk.\n";
+        m_disk.reset( new DiskCacheImageView<PixelT>( v, "tif", progress ) );
+      }
+    }
+
+    inline int32 cols() const { return m_memory ? m_memory->cols() : m_disk->cols(); }
+    inline int32 rows() const { return m_memory ? m_memory->rows() : m_disk->rows(); }
+    inline int32 planes() const { return m_memory ? m_memory->planes() : m_disk->planes(); }
+    inline bool in_memory() const { return bool(m_memory); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int32 i, int32 j, int32 p=0 ) const {
+      if ( m_memory )
+        return (*m_memory)(i,j,p);
+      return (*m_disk)(i,j,p);
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<PixelT> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      if ( m_memory )
+        return prerasterize_type( *m_memory, BBox2i(0,0,cols(),rows()) );
+      ImageView<PixelT> buf( bbox.width(), bbox.height(), planes() );
+      m_disk->rasterize( buf, bbox );
+      return prerasterize_type( buf, BBox2i(-bbox.min().x(),-bbox.min().y(),
+                                            cols(),rows()) );
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
+}
+
+#endif//__CACHE_VIEW_H__
@@ -29,37 +29,67 @@ namespace vw {
     }
   };
 
+  // Everything linearize_pinhole needs from the camera. Sampling
+  // is kept apart from the fit so that only the sampling has to be
+  // serialized for cameras that are not reentrant, like ISIS.
+  struct PinholeFitSamples {
+    Vector2i size;
+    Vector3 origin_center, center;   // Camera centers at (0,0) and the image center
+    Matrix3x3 origin_rotation;       // Camera pose at (0,0)
+    Vector3 center_vec, off_x_vec;
+    std::vector<Vector2> input;
+    std::vector<Vector3> input_vec;
+  };
+
+  PinholeFitSamples sample_pinhole_fit( camera::CameraModel* cam,
+                                        Vector2i const& size ) {
+    PinholeFitSamples samples;
+    samples.size = size;
+    Vector2 center_px  = (size - Vector2(1,1))/2.0;
+    samples.center_vec = cam->pixel_to_vector( center_px );
+    samples.off_x_vec  = cam->pixel_to_vector( center_px + Vector2i(10,0) );
+    samples.center = cam->camera_center( center_px );
+    samples.origin_center = cam->camera_center( Vector2() );
+    samples.origin_rotation = cam->camera_pose( Vector2() ).rotation_matrix();
+
+    samples.input.resize(9);
+    samples.input[0] = Vector2();
+    samples.input[1] = Vector2(size[0]/2,0);
+    samples.input[2] = Vector2(size[0]-1,0);
+    samples.input[3] = Vector2(size[0]-1,size[1]/2);
+    samples.input[4] = Vector2(size[0]-1,size[1]-1);
+    samples.input[5] = Vector2(size[0]/2,size[1]-1);
+    samples.input[6] = Vector2(0        ,size[1]-1);
+    samples.input[7] = Vector2(0        ,size[1]/2);
+    samples.input[8] = center_px;
+    samples.input_vec.resize(9);
+    for ( size_t i = 0; i < 9; i++ )
+      samples.input_vec[i] = cam->pixel_to_vector( samples.input[i] );
+    return samples;
+  }
+
   struct PinholeOptimizeFunctor : public math::LeastSquaresModelBase<PinholeOptimizeFunctor> {
     typedef Vector<double, 18> result_type;
     typedef Vector<double, 3>  domain_type;
     typedef Matrix<double>     jacobian_type;
 
-    camera::CameraModel* m_cam;
-    const std::vector<Vector2> m_measure;
-    PinholeOptimizeFunctor( camera::CameraModel* cam,
-                            std::vector<Vector2> const& measure ) : m_cam(cam), m_measure(measure) {}
+    PinholeFitSamples const& m_samples;
+    PinholeOptimizeFunctor( PinholeFitSamples const& samples ) : m_samples(samples) {}
 
     inline result_type operator()( domain_type const& x ) const {
       camera::PinholeModel ccam =
-        to_pinhole( x, m_cam->camera_center(Vector2()) );
+        to_pinhole( x, m_samples.origin_center );
       result_type output;
       for ( size_t i = 0; i < 9; i++ )
-        subvector(output,2*i,2) = m_measure[i] -
-          ccam.point_to_pixel(m_cam->camera_center(Vector2()) +
-                              1000*m_cam->pixel_to_vector(m_measure[i]));
+        subvector(output,2*i,2) = m_samples.input[i] -
+          ccam.point_to_pixel(m_samples.origin_center +
+                              1000*m_samples.input_vec[i]);
       return output;
     }
 
-    static domain_type to_vec( camera::PinholeModel const& model ) {
-      domain_type vec;
-      vec[0] = model.focal_length()[0];
-      subvector( vec, 1, 2 ) = model.point_offset();
-      return vec;
-    }
-
     camera::PinholeModel to_pinhole( domain_type const& vec,
                                      Vector3 const& center ) const {
-      return camera::PinholeModel( center, m_cam->camera_pose(Vector2()).rotation_matrix(),
+      return camera::PinholeModel( center, m_samples.origin_rotation,
                                    vec[0], vec[0], vec[1], vec[2],
                                    Vector3(1,0,0), Vector3(0,1,0),
                                    Vector3(0,0,1),
@@ -67,39 +97,33 @@ namespace vw {
     }
   };
 
+  // Fits the pinhole without touching the camera, so it is safe to
+  // run on many threads at once.
+  camera::PinholeModel fit_pinhole( PinholeFitSamples const& samples,
+                                    int& status, double& error ) {
+    Vector2i const& size = samples.size;
+    double fu = 10.0 / tan( acos( dot_prod(samples.off_x_vec, samples.center_vec ) ) );
+
+    Vector<double> seed(3);
+    seed[0] = fu;
+    seed[1] = -size[0]/2;
+    seed[2] = -size[1]/2;
+    PinholeOptimizeFunctor model( samples );
+    Vector<double> sol =
+      math::levenberg_marquardt( model, seed, Vector<double,18>(), status );
+    error = norm_2( model(sol) );
+    return model.to_pinhole( sol, samples.center );
+  }
+
   camera::PinholeModel linearize_pinhole( camera::CameraModel* cam,
                                           Vector2i const& size ) {
-    Vector2 center_px  = (size - Vector2(1,1))/2.0;
-    Vector3 center_vec = cam->pixel_to_vector( center_px );
-    Vector3 off_x_vec  = cam->pixel_to_vector( center_px + Vector2i(10,0) );
-    Vector3 off_y_vec  = cam->pixel_to_vector( center_px + Vector2i(0,10) );
-
-    double fu = 10.0 / tan( acos( dot_prod(off_x_vec, center_vec ) ) );
-    double fv = 10.0 / tan( acos( dot_prod(off_y_vec, center_vec ) ) );
-
-    camera::PinholeModel initial( cam->camera_center(center_px), cam->camera_pose(center_px).rotation_matrix(),
-                          fu, fv, -size[0]/2, -size[1]/2 );
-    initial.set_coordinate_frame( Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1) );
-
-    std::vector<Vector2> input(9);
-    input[0] = Vector2();
-    input[1] = Vector2(size[0]/2,0);
-    input[2] = Vector2(size[0]-1,0);
-    input[3] = Vector2(size[0]-1,size[1]/2);
-    input[4] = Vector2(size[0]-1,size[1]-1);
-    input[5] = Vector2(size[0]/2,size[1]-1);
-    input[6] = Vector2(0        ,size[1]-1);
-    input[7] = Vector2(0        ,size[1]/2);
-    input[8] = center_px;
-
     int status;
-    Vector<double> seed = PinholeOptimizeFunctor::to_vec( initial );
-    PinholeOptimizeFunctor model( cam, input );
-    Vector<double> sol =
-      math::levenberg_marquardt( model, seed, Vector<double,18>(), status );
+    double error;
+    camera::PinholeModel result =
+      fit_pinhole( sample_pinhole_fit( cam, size ), status, error );
     std::cout << "Status  : " << status << "\n";
-    std::cout << "Error   : " << norm_2( PinholeOptimizeFunctor(cam,input)(sol) ) << "\n";
-    return model.to_pinhole( sol, cam->camera_center(center_px) );
+    std::cout << "Error   : " << error << "\n";
+    return result;
   }
 
   camera::CAHVModel linearize_camera( camera::CameraModel* cam, Vector2i const& size ) {
@@ -11,9 +11,8 @@ template <class ViewT>
 class ApolloMask : public ImageViewBase<ApolloMask<ViewT> > {
   ViewT m_view;
   std::string m_cube_name;
-  int m_image_number;
-  ApolloShapes m_shapes;
-  double m_scaling;
+  uint8 m_frame_shapes;
+  ApolloShapes::raster_ptr m_shapes;
 public:
   typedef typename ViewT::pixel_type pixel_type;
   typedef pixel_type result_type;
@@ -21,41 +20,36 @@ public:
 
   ApolloMask( ImageViewBase<ViewT> const& view,
               std::string const& cube_name ) : m_view(view.impl()),
-                                               m_cube_name(cube_name),
-                                               m_image_number(extract_camera_number(cube_name)) {
-    m_scaling = 1145. / float(m_view.cols());
+                                               m_cube_name(cube_name) {
+    ApolloShapes shapes;
+    m_frame_shapes = shapes.frame_shapes( extract_camera_number(cube_name) );
+    m_shapes = shapes.raster( m_view.cols(), m_view.rows(),
+                              1145. / float(m_view.cols()) );
   }
 
+  ApolloMask( ImageViewBase<ViewT> const& view,
+              std::string const& cube_name, uint8 frame_shapes,
+              ApolloShapes::raster_ptr shapes ) : m_view(view.impl()),
+                                                  m_cube_name(cube_name),
+                                                  m_frame_shapes(frame_shapes),
+                                                  m_shapes(shapes) {}
+
   inline int32 cols() const { return m_view.cols(); }
   inline int32 rows() const { return m_view.rows(); }
   inline int32 planes() const { return m_view.planes(); }
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
   inline result_type operator()( int32 i, int32 j, int32 p=0 ) const {
-    Vector2f point_loc( m_scaling * i, m_scaling * j );
-    if ( m_shapes.in_fiducial( point_loc ) )
+    if ( (*m_shapes)(i,j) & m_frame_shapes )
       return result_type();
-    if ( (m_image_number >= 151941 && m_image_number <= 151944) ||
-         (m_image_number >= 152093 && m_image_number <= 152097) ||
-         (m_image_number >= 170233 && m_image_number <= 170313) ||
-         (m_image_number >= 171981 && m_image_number <= 172124) ) {
-      if ( m_shapes.in_lens_cap( point_loc ) )
-        return result_type();
-    }
-    if ( (m_image_number >= 152093 && m_image_number <= 152204) ||
-         (m_image_number >= 161145 && m_image_number <= 161650) ||
-         (m_image_number >= 161896 && m_image_number <= 161985) ||
-         (m_image_number >= 162155 && m_image_number <= 162845) ) {
-      if ( m_shapes.in_antenna( point_loc ) )
-        return result_type();
-    }
     return m_view(i,j,p);
   }
 
   /// \cond INTERNAL
   typedef ApolloMask<typename ViewT::prerasterize_type> prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return ApolloMask<typename ViewT::prerasterize_type>( m_view.prerasterize(bbox), m_cube_name ); }
+    return prerasterize_type( m_view.prerasterize(bbox), m_cube_name,
+                              m_frame_shapes, m_shapes ); }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
   }
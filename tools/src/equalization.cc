@@ -5,112 +5,105 @@
 #include <vw/Math.h>
 #include <vw/Core.h>
 #include <iostream>
+#include <queue>
+#include <algorithm>
 
 using namespace vw;
 using namespace vw::ip;
 
-// Algorithm for removing interest points
-inline void remove_max( std::vector<std::vector<InterestPoint> > &b_ip1,
-		 std::vector<std::vector<InterestPoint> > &b_ip2 ) {
-  int max_index = 0;
-  int max_count = 0;
-  for ( unsigned i = 0; i < b_ip1.size(); i++ ) 
-    if (b_ip1[i].size() > max_count ) {
-      max_count = b_ip1[i].size();
-      max_index = i;
-    }
-
-  int point_idx = 0;
-  int point_interest = -200000;
-  for ( unsigned i = 0; i < b_ip1[max_index].size(); i++ ) {
-    if ( b_ip1[max_index][i].interest > point_interest ) {
-      point_interest = b_ip1[max_index][i].interest;
-      point_idx = i;
-    }
+// Orders positions within a cell so the point remove_max would take
+// first comes first: highest interest, earliest on ties.
+struct InterestOrder {
+  std::vector<InterestPoint> const& ip;
+  std::vector<size_t> const& cell;
+  InterestOrder( std::vector<InterestPoint> const& ip,
+                 std::vector<size_t> const& cell ) : ip(ip), cell(cell) {}
+  bool operator()( size_t a, size_t b ) const {
+    return ip[cell[a]].interest > ip[cell[b]].interest;
   }
+};
 
-  // Okay dokey making my remove
-  b_ip1[max_index].erase( b_ip1[max_index].begin() + point_idx );
-  b_ip2[max_index].erase( b_ip2[max_index].begin() + point_idx );
-}
-
-// divide block
-std::vector<BBox2i> divide_block( BBox2i const& orginal,
-				  int div_x, int div_y ) {
-  std::vector<BBox2i> bboxes;
-  Vector2 min = orginal.min();
-  
-  Vector2 lmin, lmax;
+void bucket_points( std::vector<InterestPoint> const& ip,
+		    int grid_x, int grid_y,
+		    std::vector<std::vector<size_t> >& cells ) {
+  if ( grid_x < 1 || grid_y < 1 )
+    vw_throw( ArgumentErr() << "bucket_points: grid must be at least 1x1, got "
+	      << grid_x << "x" << grid_y << ".\n" );
+  cells.clear();
+  cells.resize( grid_x * grid_y );
+  BBox2 bbox;
+  for ( unsigned i = 0; i < ip.size(); ++i )
+    bbox.grow( Vector2( ip[i].x, ip[i].y ) );
 
-  for ( unsigned i = 0; i < div_x; i++ ) {
-    lmin.x() = min.x() + i*orginal.width()/float(div_x);
-    if ( i == div_x -1 ) 
-      lmax.x() = orginal.max().x();
-    else
-      lmax.x() = min.x() + (i+1)*orginal.width()/float(div_x);
-    for ( unsigned j = 0; j < div_y; j++ ) {
-      lmin.y() = min.y() + j*orginal.height()/float(div_y);
-      if ( j == div_y-1 ) 
-	lmax.y() = orginal.max().y();
-      else
-	lmax.y() = min.y() + (j+1)*orginal.height()/float(div_y);
-     
-      bboxes.push_back( BBox2i( lmin, lmax ) );
-    }
+  // Points on the max edge are clamped into the last cell
+  double scale_x = bbox.width()  > 0 ? grid_x / bbox.width()  : 0;
+  double scale_y = bbox.height() > 0 ? grid_y / bbox.height() : 0;
+  for ( unsigned i = 0; i < ip.size(); ++i ) {
+    int x = std::min( int( (ip[i].x - bbox.min().x()) * scale_x ), grid_x - 1 );
+    int y = std::min( int( (ip[i].y - bbox.min().y()) * scale_y ), grid_y - 1 );
+    cells[ x * grid_y + y ].push_back( i );
   }
-  
-  return bboxes;
 }
 
 void equalization( std::vector<InterestPoint>& l_ip,
 		   std::vector<InterestPoint>& r_ip,
-		   int max_points ) {
+		   int max_points, int grid_x, int grid_y ) {
+  if ( grid_x < 1 || grid_y < 1 )
+    vw_throw( ArgumentErr() << "equalization: grid must be at least 1x1, got "
+	      << grid_x << "x" << grid_y << ".\n" );
+
   // Checking for early exit condition
   if ( l_ip.size() <= max_points ) {
     std::cout << "\t> Exiting early, found less than " << max_points << " matches.\n";
     return;
   }
 
-  //TerminalProgressCallback progress;
-  //progress.report_progress(0);
-
   // Reducing to an even distribution
-  std::cout << "Building Bounding Boxes:\n";
-  BBox2i total_bbox;
-  for ( unsigned i = 0; i < l_ip.size(); ++i )
-    total_bbox.grow( Vector2( l_ip[i].x, l_ip[i].y ) );
-  std::vector<BBox2i> bboxes = divide_block( total_bbox, 5, 5 );
-  std::vector<std::vector<InterestPoint> > b_ip1;
-  std::vector<std::vector<InterestPoint> > b_ip2;
-  b_ip1.resize( bboxes.size() );
-  b_ip2.resize( bboxes.size() );
-  for ( unsigned b = 0; b < bboxes.size(); ++b )
-    for ( unsigned i = 0; i < l_ip.size(); ++i )
-      if ( bboxes[b].contains( Vector2( l_ip[i].x, l_ip[i].y ) ) ) {
-	b_ip1[b].push_back( l_ip[i] );
-	b_ip2[b].push_back( r_ip[i] );
-      }
+  std::vector<std::vector<size_t> > cells;
+  bucket_points( l_ip, grid_x, grid_y, cells );
 
   // Finding how many points there are
   int count = 0;
-  for ( unsigned b = 0; b < b_ip1.size(); ++b )
-    count += b_ip1[b].size();
+  for ( unsigned b = 0; b < cells.size(); ++b )
+    count += cells[b].size();
 
-  // Remove until less that max
-  //int diff = count - max_points;
+  // Always take from the fullest cell, lowest index on ties. Only the
+  // number removed per cell is tracked here.
+  typedef std::pair<size_t,int> cell_key; // count, -index
+  std::priority_queue<cell_key> heap;
+  for ( unsigned b = 0; b < cells.size(); ++b )
+    heap.push( cell_key( cells[b].size(), -int(b) ) );
+  std::vector<size_t> removed( cells.size(), 0 );
   while ( count > max_points ) {
-    //progress.report_progress(1-float(count-max_points)/float(diff));
-    remove_max( b_ip1, b_ip2 );
+    cell_key top = heap.top();
+    heap.pop();
+    removed[ -top.second ]++;
+    heap.push( cell_key( top.first - 1, top.second ) );
     count--;
   }
-  //progress.report_finished();
 
-  // Reorganize back into correct form
-  l_ip.clear();
-  r_ip.clear();
-  for ( unsigned b = 0; b < b_ip1.size(); ++b )
-    for ( unsigned i = 0; i < b_ip1[b].size(); ++i ) {
-      l_ip.push_back( b_ip1[b][i] );
-      r_ip.push_back( b_ip2[b][i] );
+  // Reorganize back into correct form, dropping each cell's highest
+  // interest points.
+  std::vector<InterestPoint> out_ip1, out_ip2;
+  out_ip1.reserve( count );
+  out_ip2.reserve( count );
+  for ( unsigned b = 0; b < cells.size(); ++b ) {
+    std::vector<bool> keep( cells[b].size(), true );
+    if ( removed[b] ) {
+      std::vector<size_t> order( cells[b].size() );
+      for ( size_t i = 0; i < order.size(); ++i )
+	order[i] = i;
+      std::stable_sort( order.begin(), order.end(),
+			InterestOrder( l_ip, cells[b] ) );
+      for ( size_t i = 0; i < removed[b]; ++i )
+	keep[ order[i] ] = false;
     }
+    for ( unsigned i = 0; i < cells[b].size(); ++i )
+      if ( keep[i] ) {
+	out_ip1.push_back( l_ip[ cells[b][i] ] );
+	out_ip2.push_back( r_ip[ cells[b][i] ] );
+      }
+  }
+  l_ip.swap( out_ip1 );
+  r_ip.swap( out_ip2 );
 }
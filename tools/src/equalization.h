@@ -1,13 +1,23 @@
 // This will knock off weak points where we already have a lot of
 // points. This is hopefully to produce a better distribution.
+//
+// The matches are divided into a grid_x by grid_y grid and points are
+// removed from whichever cell is fullest until max_points remain.
 #ifndef __EQUALIZATION_H__
 #define __EQUALIZATION_H__
 
 #include <vw/InterestPoint/InterestData.h>
 #include <vector>
 
+// Sorts points into a grid_x by grid_y grid over their bounding box in
+// a single pass. Every point lands in exactly one cell; points on the
+// far edges go to the last row or column. Cell (x,y) is x*grid_y+y.
+void bucket_points( std::vector<vw::ip::InterestPoint> const& ip,
+		    int grid_x, int grid_y,
+		    std::vector<std::vector<size_t> >& cells );
+
 void equalization( std::vector<vw::ip::InterestPoint>& l_ip,
 		   std::vector<vw::ip::InterestPoint>& r_ip,
-		   int max_points );
+		   int max_points, int grid_x = 5, int grid_y = 5 );
 
 #endif//__EQUALIZATION_H__
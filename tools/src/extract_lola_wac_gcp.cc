@@ -7,7 +7,6 @@
 #include <vw/Math/Geometry.h>
 
 #include <asp/IsisIO/IsisAdjustCameraModel.h>
-#include <asp/ControlNetTK/Equalization.h>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/program_options.hpp>
@@ -16,6 +15,7 @@ namespace fs = boost::filesystem;
 #include <boost/foreach.hpp>
 
 #include "camera_solve.h"
+#include "equalization.h"
 
 using namespace vw;
 using namespace vw::camera;
@@ -257,7 +257,7 @@ int main( int argc, char* argv[] ) {
         std::cout << "Found " << final_ip1.size() << " points prior equalization.\n";
 
         // Equalizing matches
-        asp::cnettk::equalization( final_ip1, final_ip2, 10 );
+        equalization( final_ip1, final_ip2, 10 );
 
         ip::write_binary_match_file(match_file, final_ip1, final_ip2);
       } catch ( ... ) {
@@ -1,3 +1,4 @@
+#include <vw/Core.h>
 #include <vw/Image.h>
 #include <vw/FileIO.h>
 #include <vw/InterestPoint.h>
@@ -6,11 +7,14 @@
 
 #include "LolaQuery.h"
 #include "ApolloShapes.h"
+#include "patch_descriptors.h"
+#include "cache_view.h"
+#include "equalization.h"
 
 #include <asp/IsisIO/IsisAdjustCameraModel.h>
-#include <asp/ControlNetTK/Equalization.h>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -68,97 +72,143 @@ bool perform_matching( std::list<ip::InterestPoint> const& wac_ip,
   return true;
 }
 
-int main( int argc, char* argv[] ) {
-
-  std::string cube_file;
-  po::options_description general_options("Options");
-  general_options.add_options()
-    ("cube-file", po::value(&cube_file), "Input cube file.")
-    ("save-images", "Save the images used for IP matching.")
-    ("help,h", "Display this help message");
+// Data that is expensive to load and is shared between every frame
+// processed by this process.
+class SharedResources : private boost::noncopyable {
+public:
+  typedef InterpolationView<EdgeExtensionView<ImageViewRef<double>, ConstantEdgeExtension>, BicubicInterpolation> lola_view_type;
+  struct LOLATile {
+    std::string filename;
+    cartography::GeoReference georef;
+    lola_view_type image;
+    LOLATile( std::string const& f, cartography::GeoReference const& g,
+              lola_view_type const& i ) : filename(f), georef(g), image(i) {}
+  };
+
+private:
+  LOLAQuery m_lola_database;
+  std::map<std::pair<size_t,bool>, LOLATile> m_lola_tiles;
+  Mutex m_lola_mutex;
+
+public:
+  std::string wac_file;
+  DiskImageView<PixelGray<float> > wac_image;
+  float wac_nodata_value;
+  cartography::GeoReference wac_georef;
+  double wac_degree_scale;
+
+  // ISIS and NAIF are not reentrant. Everything that touches an ISIS
+  // camera model needs to hold this lock.
+  Mutex isis_mutex;
+
+  // Masks for the fiducials, lens cap and antenna. Safe to query from
+  // every frame at once.
+  ApolloShapes shapes;
+
+  SharedResources( std::string const& wac ) : wac_file(wac), wac_image(wac),
+                                              wac_nodata_value(-3.40282265508890445e+38) {
+    std::cout << "WAC nodata: " << wac_nodata_value << "\n";
+    cartography::read_georeference( wac_georef, wac_file );
+    std::cout << "Using WAC georef:\n" << wac_georef << "\n";
+    wac_degree_scale =
+      norm_2(wac_georef.pixel_to_lonlat( Vector2( wac_image.cols(), wac_image.rows() ) / 2 + Vector2(1,0) )
+             - wac_georef.pixel_to_lonlat( Vector2( wac_image.cols(), wac_image.rows() ) / 2 ));
+    std::cout << "WAC Degree scale: " << wac_degree_scale << "\n";
+  }
 
-  po::positional_options_description p;
-  p.add("cube-file", 1);
+  // Returns the LOLA tile that covers lonlat. Tiles are opened the
+  // first time they are requested and then reused by all frames.
+  LOLATile const& lola_tile( Vector2 const& lonlat ) {
+    std::pair<size_t,bool> key( m_lola_database.find_index( lonlat ),
+                                lonlat[0] < 0 );
+    Mutex::Lock lock( m_lola_mutex );
+    std::map<std::pair<size_t,bool>, LOLATile>::const_iterator it =
+      m_lola_tiles.find( key );
+    if ( it != m_lola_tiles.end() )
+      return it->second;
 
-  po::variables_map vm;
-  po::store( po::command_line_parser( argc, argv ).options(general_options).positional(p).run(), vm );
-  po::notify( vm );
+    std::pair<cartography::GeoReference, std::string> result =
+      m_lola_database.find_tile( lonlat );
+    std::cout << "Using LOLA tile: " << result.second << "\n";
+    return m_lola_tiles.insert( std::make_pair( key, LOLATile( result.second, result.first,
+      interpolate(ImageViewRef<double>(DiskImageView<double>(result.second)),
+                  BicubicInterpolation(), ConstantEdgeExtension()) ) ) ).first->second;
+  }
+};
 
-  std::ostringstream usage;
-  usage << "Usage: " << argv[0] << "[options] <cube file>\n\n";
-  usage << general_options << std::endl;
+// Per frame processing settings.
+struct ExtractOptions {
+  bool save_images;
+  size_t cache_memory; // Bytes each cached raster may hold in RAM
+};
 
-  if ( vm.count("help" ) ) {
-    vw_out() << usage.str() << std::endl;
-    return 1;
-  } else if ( cube_file.empty() ) {
-    vw_out() << "ERROR! Missing input file.\n";
-    vw_out() << usage.str() << std::endl;
-    return 1;
-  }
+// Outcome of a single frame, used to produce the run summary.
+struct FrameSummary {
+  std::string cube_file;
+  bool success;
+  size_t num_gcp;
+  std::string message;
+  FrameSummary() : success(false), num_gcp(0) {}
+};
 
-  // Loading CONSTANT measurement data
-  LOLAQuery lola_database;
-  std::string wac_file("/Users/zmoratto/Data/Moon/LROWAC/global_100m_JanFeb_and_JulyAug.180.cub");
-  DiskImageView<PixelGray<float> > wac_image( wac_file );
-  float wac_nodata_value = -3.40282265508890445e+38;
-  std::cout << "WAC nodata: " << wac_nodata_value << "\n";
-  cartography::GeoReference wac_georef;
-  cartography::read_georeference( wac_georef,  wac_file );
-  std::cout << "Using WAC georef:\n" << wac_georef << "\n";
-  double wac_degree_scale =
-    norm_2(wac_georef.pixel_to_lonlat( Vector2( wac_image.cols(), wac_image.rows() ) / 2 + Vector2(1,0) )
-           - wac_georef.pixel_to_lonlat( Vector2( wac_image.cols(), wac_image.rows() ) / 2 ));
-  std::cout << "WAC Degree scale: " << wac_degree_scale << "\n";
+bool extract_gcp( std::string const& cube_file, SharedResources& shared,
+                  ExtractOptions const& opt, FrameSummary& summary ) {
+  summary.cube_file = cube_file;
 
   // Loading input camera and image
-  boost::shared_ptr<camera::CameraModel> model;
   DiskImageView<PixelGray<float> > image( fs::path( cube_file ).replace_extension(".tif").string() );
-  std::string adjust_file =
-    fs::path( cube_file ).replace_extension("isis_adjust").string();
   std::string serial_number;
-  if ( fs::exists( adjust_file ) ) {
-    vw_out() << "Loading \"" << adjust_file << "\"\n";
-    std::ifstream input( adjust_file.c_str() );
-    boost::shared_ptr<asp::BaseEquation> posF = asp::read_equation(input);
-    boost::shared_ptr<asp::BaseEquation> poseF = asp::read_equation(input);
-    input.close();
-    boost::shared_ptr<camera::IsisAdjustCameraModel> child( new camera::IsisAdjustCameraModel( cube_file, posF, poseF ) );
-    serial_number = child->serial_number();
-    model = child;
-  } else {
-    vw_out() << "Loading \"" << cube_file << "\"\n";
-    boost::shared_ptr<camera::IsisCameraModel> child(new camera::IsisCameraModel( cube_file ) );
-    serial_number = child->serial_number();
-    model = child;
-  }
+  double rotate, degree_scale;
+  Vector3 camera_center;
+  {
+    Mutex::Lock lock( shared.isis_mutex );
+    boost::shared_ptr<camera::CameraModel> model;
+    std::string adjust_file =
+      fs::path( cube_file ).replace_extension("isis_adjust").string();
+    if ( fs::exists( adjust_file ) ) {
+      vw_out() << "Loading \"" << adjust_file << "\"\n";
+      std::ifstream input( adjust_file.c_str() );
+      boost::shared_ptr<asp::BaseEquation> posF = asp::read_equation(input);
+      boost::shared_ptr<asp::BaseEquation> poseF = asp::read_equation(input);
+      input.close();
+      boost::shared_ptr<camera::IsisAdjustCameraModel> child( new camera::IsisAdjustCameraModel( cube_file, posF, poseF ) );
+      serial_number = child->serial_number();
+      model = child;
+    } else {
+      vw_out() << "Loading \"" << cube_file << "\"\n";
+      boost::shared_ptr<camera::IsisCameraModel> child(new camera::IsisCameraModel( cube_file ) );
+      serial_number = child->serial_number();
+      model = child;
+    }
 
-  // Working out scale and rotation
-  cartography::GeoReference georef( cartography::Datum("D_MOON"),
-                                    math::identity_matrix<3>() );
-  bool working;
-  Vector2 l_direction =
-    cartography::geospatial_intersect( Vector2(), georef, model,
-                                       1, working ) -
-    cartography::geospatial_intersect( Vector2(0,image.rows()-1),
-                                       georef, model, 1, working );
-  if (l_direction[0] < -200)
-    l_direction[0] += 360;
-  if (l_direction[0] > 200 )
-    l_direction[0] -= 360;
-  Vector2 r_direction =
-    cartography::geospatial_intersect( Vector2(image.cols()-1,0), georef,
-                                       model, 1, working ) -
-    cartography::geospatial_intersect( Vector2(image.cols(),image.rows()) - Vector2(1,1),
-                                       georef, model, 1, working );
-  if (r_direction[0] < -200)
-    r_direction[0] += 360;
-  if (r_direction[0] > 200)
-    r_direction[0] -= 360;
-  double rotate = M_PI/2 - (atan2(l_direction[1],l_direction[0]) +
-                            atan2(r_direction[1],r_direction[0]) )/2;
-  double degree_scale =
-    (norm_2(l_direction)+norm_2(r_direction)) / ( image.cols() + image.rows() );
+    // Working out scale and rotation
+    cartography::GeoReference georef( cartography::Datum("D_MOON"),
+                                      math::identity_matrix<3>() );
+    bool working;
+    Vector2 l_direction =
+      cartography::geospatial_intersect( Vector2(), georef, model,
+                                         1, working ) -
+      cartography::geospatial_intersect( Vector2(0,image.rows()-1),
+                                         georef, model, 1, working );
+    if (l_direction[0] < -200)
+      l_direction[0] += 360;
+    if (l_direction[0] > 200 )
+      l_direction[0] -= 360;
+    Vector2 r_direction =
+      cartography::geospatial_intersect( Vector2(image.cols()-1,0), georef,
+                                         model, 1, working ) -
+      cartography::geospatial_intersect( Vector2(image.cols(),image.rows()) - Vector2(1,1),
+                                         georef, model, 1, working );
+    if (r_direction[0] < -200)
+      r_direction[0] += 360;
+    if (r_direction[0] > 200)
+      r_direction[0] -= 360;
+    rotate = M_PI/2 - (atan2(l_direction[1],l_direction[0]) +
+                       atan2(r_direction[1],r_direction[0]) )/2;
+    degree_scale =
+      (norm_2(l_direction)+norm_2(r_direction)) / ( image.cols() + image.rows() );
+    camera_center = model->camera_center(Vector2());
+  }
   std::cout << "Degree scale: " << degree_scale << "\n";
   Vector2 pivot = (Vector2(image.cols(),image.rows()) - Vector2(1,1))/2;
 
@@ -175,30 +225,30 @@ int main( int argc, char* argv[] ) {
            RotateTransform( rotate, pivot ) );
   Vector2 trans_image_size(extension*2+image.cols(),
                            extension*2+image.rows());
-  DiskCacheImageView<PixelGray<float> > trans_cache(
+  MemoryCacheImageView<PixelGray<float> > trans_cache(
       crop(transform( image, trans ), 0, 0,
-           trans_image_size[0], trans_image_size[1]), "tif",
+           trans_image_size[0], trans_image_size[1]), opt.cache_memory,
       TerminalProgressCallback("","Caching Input:") );
 
   // Rasterizing a section of WAC at the same scale and area as our
   Vector2 wac_deg_origin =
-    subvector(cartography::xyz_to_lon_lat_radius(model->camera_center(Vector2())),0,2) -
+    subvector(cartography::xyz_to_lon_lat_radius(camera_center),0,2) -
     elem_prod(Vector2(1,-1),(trans_image_size * degree_scale)/2);
   vw_out() << "-> WAC degree center: "
-           << cartography::xyz_to_lon_lat_radius(model->camera_center(Vector2())) << "\n";
+           << cartography::xyz_to_lon_lat_radius(camera_center) << "\n";
   Vector2 wac_pix_origin =
-    wac_georef.lonlat_to_pixel( wac_deg_origin );
+    shared.wac_georef.lonlat_to_pixel( wac_deg_origin );
   CompositionTransform<ResampleTransform,TranslateTransform>
-    wac_trans( ResampleTransform( wac_degree_scale/degree_scale,
-                                  wac_degree_scale/degree_scale),
+    wac_trans( ResampleTransform( shared.wac_degree_scale/degree_scale,
+                                  shared.wac_degree_scale/degree_scale),
                TranslateTransform( -wac_pix_origin[0], -wac_pix_origin[1] ) );
-  DiskCacheImageView<PixelGray<float> > wac_cache(
-    apply_mask(normalize(crop(transform( create_mask(wac_image,wac_nodata_value), wac_trans,
+  MemoryCacheImageView<PixelGray<float> > wac_cache(
+    apply_mask(normalize(crop(transform( create_mask(shared.wac_image,shared.wac_nodata_value), wac_trans,
                                          CylindricalEdgeExtension()), 0, 0,
-                              trans_image_size[0], trans_image_size[1]))), "tif",
+                              trans_image_size[0], trans_image_size[1]))), opt.cache_memory,
     TerminalProgressCallback("","Caching WAC:") );
 
-  if ( vm.count("save-images") ) {
+  if ( opt.save_images ) {
     std::string prefix = fs::path(cube_file).stem();
     write_image( prefix+"_wac_cache.tif", wac_cache );
     write_image( prefix+"_amc_cache.tif", trans_cache );
@@ -211,75 +261,37 @@ int main( int argc, char* argv[] ) {
     ip::OBALoGInterestOperator interest_operator(.035);
     ip::IntegralInterestPointDetector<ip::OBALoGInterestOperator> detector( interest_operator,
                                                                             0 );
-    ip::SGradDescriptorGenerator gen;
 
     trans_ip = detect_interest_points(trans_cache,detector);
-    ApolloShapes shapes;
+    ApolloShapes const& shapes = shared.shapes;
     {
       BBox2f trans_bbox = bounding_box(trans_cache);
       trans_bbox.contract(1);
-      int32 image_number = extract_camera_number( cube_file );
-      for ( ip::InterestPointList::iterator point = trans_ip.begin();
-            point != trans_ip.end(); ++point ) {
+      uint8 frame_shapes =
+        shapes.frame_shapes( extract_camera_number( cube_file ) );
+      ip::InterestPointList::iterator point = trans_ip.begin();
+      while ( point != trans_ip.end() ) {
         Vector2f point_loc = trans.reverse( Vector2f(point->x,
                                                      point->y) );
-        bool todelete = false;
         if ( !trans_bbox.contains( point_loc ) ||
-             shapes.in_fiducial( point_loc ) )
-          todelete = true;
-        if ( image_number == 151944 ||
-             (image_number >= 170233 && image_number <= 170313) ||
-             (image_number >= 171981 && image_number <= 172124) ) {
-          if ( shapes.in_lens_cap( point_loc ) )
-            todelete = true;
-        }
-        if ( (image_number >= 152093 && image_number <= 152204) ||
-             (image_number >= 161145 && image_number <= 161650) ||
-             (image_number >= 161897 && image_number <= 161985) ||
-             (image_number >= 162156 && image_number <= 162845) ) {
-          if ( shapes.in_antenna( point_loc ) )
-            todelete = true;
-        }
-        if ( todelete ) {
+             ( shapes.shapes_at( point_loc ) & frame_shapes ) )
           point = trans_ip.erase(point);
-          point--;
-          continue;
-        }
+        else
+          point++;
       }
     }
     vw_out() << "\tDetected Input IP: " << trans_ip.size() << "\n";
-    BOOST_FOREACH( ip::InterestPoint& pt, trans_ip ) {
-      float scaling = 1.0f / pt.scale;
-      ImageView<PixelGray<float> > patch =
-        transform( trans_cache,
-                   AffineTransform( Matrix2x2( scaling, 0, 0, scaling ),
-                                    Vector2(-scaling*pt.x+20.5,
-                                            -scaling*pt.y+20.5) ),
-                   42, 42 );
-      pt.descriptor.set_size( 180 );
-      gen.compute_descriptor( patch, pt.begin(), pt.end() );
-    }
+    describe_sgrad( trans_cache, trans_ip );
   }
 
   { // WAC IP
     ip::OBALoGInterestOperator interest_operator(.020);
     ip::IntegralInterestPointDetector<ip::OBALoGInterestOperator> detector( interest_operator,
                                                                             0 );
-    ip::SGradDescriptorGenerator gen;
 
     wac_ip = detect_interest_points(wac_cache,detector);
     vw_out() << "\tDetected WAC IP: " << wac_ip.size() << "\n";
-    BOOST_FOREACH( ip::InterestPoint& pt, wac_ip ) {
-      float scaling = 1.0f / pt.scale;
-      ImageView<PixelGray<float> > patch =
-        transform( wac_cache,
-                   AffineTransform( Matrix2x2( scaling, 0, 0, scaling ),
-                                    Vector2(-scaling*pt.x+20.5,
-                                            -scaling*pt.y+20.5) ),
-                   42, 42 );
-      pt.descriptor.set_size( 180 );
-      gen.compute_descriptor( patch, pt.begin(), pt.end() );
-    }
+    describe_sgrad( wac_cache, wac_ip );
   }
 
   // Matching
@@ -347,7 +359,8 @@ int main( int argc, char* argv[] ) {
            align_matrix(0,0) < 0 || align_matrix(1,1) < 0 ) {
         vw_out(ErrorMessage) << "RANSAC FITTED TO OUTLIER\n\tOUTLIER: "
                              << align_matrix << "\n";
-        return 1;
+        summary.message = "RANSAC fitted to outlier";
+        return false;
       }
 
       vw_out() << "\t-> Align Matrix: " << align_matrix << "\n";
@@ -356,7 +369,8 @@ int main( int argc, char* argv[] ) {
 
       if ( ransac_indices.size() < 6 ) {
         vw_out(ErrorMessage) << "FAILED TO FIND ENOUGH IPs\n";
-        return 1;
+        summary.message = "Failed to find enough IPs";
+        return false;
       }
 
       output_wac_ip.clear();
@@ -373,7 +387,7 @@ int main( int argc, char* argv[] ) {
     vw_out() << "\t-> Found " << output_wac_ip.size() << " points prior equalization.\n";
 
     // Equalizing matches
-    asp::cnettk::equalization( output_wac_ip, output_trans_ip, 20 );
+    equalization( output_wac_ip, output_trans_ip, 20 );
 
     trans_ip.clear();
     wac_ip.clear();
@@ -385,10 +399,6 @@ int main( int argc, char* argv[] ) {
 
   // Build control network of measurements
   ba::ControlNetwork cnet("WAC LOLA GCPs v3",ba::ControlNetwork::ImageToGround);
-  InterpolationView<EdgeExtensionView<ImageViewRef<double>, ConstantEdgeExtension>, BicubicInterpolation> current_lola_image =
-    interpolate(ImageViewRef<double>(), BicubicInterpolation(), ConstantEdgeExtension());
-  std::string current_lola_file;
-  cartography::GeoReference current_lola_georef;
   for ( ip::InterestPointList::iterator trans_pt = trans_ip.begin(),
           wac_pt = wac_ip.begin(); trans_pt != trans_ip.end(); ++trans_pt, ++wac_pt ) {
 
@@ -397,23 +407,14 @@ int main( int argc, char* argv[] ) {
                                                trans_pt->y ) );
     // Convert WAC to actual lonlat location
     Vector2 wac_lonlat =
-      wac_georef.pixel_to_lonlat( wac_trans.reverse( Vector2( wac_pt->x,
-                                                              wac_pt->y ) ) );
+      shared.wac_georef.pixel_to_lonlat( wac_trans.reverse( Vector2( wac_pt->x,
+                                                                     wac_pt->y ) ) );
 
     // Load corresponding LOLA data
-    std::pair<cartography::GeoReference, std::string> result =
-      lola_database.find_tile( wac_lonlat );
-    if ( result.second != current_lola_file ) {
-      std::cout << "Using LOLA tile: " << result.second << "\n";
-      current_lola_file = result.second;
-      current_lola_georef = result.first;
-      current_lola_image =
-        interpolate(ImageViewRef<double>(DiskImageView<double>(result.second)),
-                    BicubicInterpolation(), ConstantEdgeExtension());
-    }
-    Vector2 lola_pt = current_lola_georef.lonlat_to_pixel(wac_lonlat);
-    double radius = current_lola_image(lola_pt[0],lola_pt[1]) +
-      current_lola_georef.datum().radius( wac_lonlat[0], wac_lonlat[1] );
+    SharedResources::LOLATile const& lola = shared.lola_tile( wac_lonlat );
+    Vector2 lola_pt = lola.georef.lonlat_to_pixel(wac_lonlat);
+    double radius = lola.image(lola_pt[0],lola_pt[1]) +
+      lola.georef.datum().radius( wac_lonlat[0], wac_lonlat[1] );
 
     std::cout << amc_pt << " -> " << wac_lonlat << " " << radius << "\n";
 
@@ -434,5 +435,138 @@ int main( int argc, char* argv[] ) {
 
   cnet.write_binary(fs::path(cube_file).stem()+"_lola_wac.cnet");
 
+  summary.num_gcp = cnet.size();
+  summary.success = true;
+  return true;
+}
+
+// A single frame of a batch run.
+class ExtractTask : public Task {
+  std::string m_cube_file;
+  SharedResources& m_shared;
+  ExtractOptions const& m_options;
+  FrameSummary& m_summary;
+public:
+  ExtractTask( std::string const& cube_file, SharedResources& shared,
+               ExtractOptions const& options, FrameSummary& summary ) :
+    m_cube_file(cube_file), m_shared(shared), m_options(options),
+    m_summary(summary) {}
+
+  virtual ~ExtractTask() {}
+  virtual void operator()() {
+    try {
+      extract_gcp( m_cube_file, m_shared, m_options, m_summary );
+    } catch ( Exception const& e ) {
+      m_summary.success = false;
+      m_summary.message = e.what();
+    } catch ( std::exception const& e ) {
+      m_summary.success = false;
+      m_summary.message = e.what();
+    }
+    vw_out() << "Finished " << m_cube_file << " ["
+             << ( m_summary.success ? "OK" : "FAILED" ) << "]\n";
+  }
+};
+
+int main( int argc, char* argv[] ) {
+
+  std::string cube_file, cube_list_file, summary_file;
+  int num_threads;
+  size_t cache_memory_mb;
+  po::options_description general_options("Options");
+  general_options.add_options()
+    ("cube-file", po::value(&cube_file), "Input cube file.")
+    ("cube-list", po::value(&cube_list_file), "A file listing input cube files to process in a single run.")
+    ("threads", po::value(&num_threads)->default_value(4), "Number of frames to process concurrently with --cube-list.")
+    ("summary-file", po::value(&summary_file)->default_value("lola_wac_gcp_summary.txt"), "Where to write the run summary for --cube-list.")
+    ("cache-memory", po::value(&cache_memory_mb)->default_value(2048), "Megabytes of RAM for the rotated input and WAC rasters, shared by every frame being processed at once. Rasters over their share are cached to disk instead.")
+    ("save-images", "Save the images used for IP matching.")
+    ("help,h", "Display this help message");
+
+  po::positional_options_description p;
+  p.add("cube-file", 1);
+
+  po::variables_map vm;
+  po::store( po::command_line_parser( argc, argv ).options(general_options).positional(p).run(), vm );
+  po::notify( vm );
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << "[options] <cube file>\n";
+  usage << "       " << argv[0] << "[options] --cube-list <list file>\n\n";
+  usage << general_options << std::endl;
+
+  if ( vm.count("help" ) ) {
+    vw_out() << usage.str() << std::endl;
+    return 1;
+  } else if ( cube_file.empty() && cube_list_file.empty() ) {
+    vw_out() << "ERROR! Missing input file.\n";
+    vw_out() << usage.str() << std::endl;
+    return 1;
+  }
+
+  // Loading CONSTANT measurement data
+  SharedResources shared("/Users/zmoratto/Data/Moon/LROWAC/global_100m_JanFeb_and_JulyAug.180.cub");
+
+  ExtractOptions options;
+  options.save_images = vm.count("save-images");
+  // Each frame holds two cached rasters
+  options.cache_memory = cache_memory_mb * 1024 * 1024 / 2;
+
+  if ( cube_list_file.empty() ) {
+    FrameSummary summary;
+    if ( !extract_gcp( cube_file, shared, options, summary ) )
+      return 1;
+    return 0;
+  }
+
+  // Batch mode, each frame is a task on a thread pool
+  std::vector<std::string> cube_files;
+  {
+    std::ifstream cubelist( cube_list_file.c_str(), std::ifstream::in );
+    if ( !cubelist.is_open() )
+      vw_throw( ArgumentErr() << "Unable to open \"" << cube_list_file << "\"." );
+    std::string buffer;
+    while ( std::getline( cubelist, buffer ) ) {
+      if ( !buffer.empty() )
+        cube_files.push_back( buffer );
+    }
+  }
+  if ( num_threads < 1 )
+    num_threads = 1;
+  vw_out() << "Processing " << cube_files.size() << " cubes with "
+           << num_threads << " threads.\n";
+
+  // The memory budget is split between the frames in flight
+  options.cache_memory /=
+    std::max( size_t(1), std::min( size_t(num_threads), cube_files.size() ) );
+
+  std::vector<FrameSummary> summaries( cube_files.size() );
+  {
+    FifoWorkQueue queue( num_threads );
+    for ( size_t i = 0; i < cube_files.size(); i++ ) {
+      boost::shared_ptr<Task> task( new ExtractTask( cube_files[i], shared,
+                                                     options, summaries[i] ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+  }
+
+  // Writing run summary
+  size_t num_success = 0, num_gcp = 0;
+  std::ofstream summary( summary_file.c_str(), std::ofstream::out );
+  summary << "# cube, status, gcps, message\n";
+  BOOST_FOREACH( FrameSummary const& s, summaries ) {
+    summary << s.cube_file << ", " << ( s.success ? "OK" : "FAILED" ) << ", "
+            << s.num_gcp << ", " << s.message << "\n";
+    if ( s.success ) {
+      num_success++;
+      num_gcp += s.num_gcp;
+    }
+  }
+  summary.close();
+  vw_out() << "Succeeded on " << num_success << " of " << summaries.size()
+           << " cubes, " << num_gcp << " GCPs total.\n";
+  vw_out() << "Wrote summary: " << summary_file << "\n";
+
   return 0;
 }
@@ -0,0 +1,182 @@
+#ifndef __FOOTPRINT_H__
+#define __FOOTPRINT_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Math/Vector.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+namespace vw {
+
+  // Corner coordinates of an image as (latitude, longitude) in
+  // degrees. Corners are in the order (1,1), (1,lines),
+  // (samples,lines), (samples,1).
+  struct Footprint {
+    Vector2 corners[4];
+  };
+
+  inline void write_footprint( std::string const& filename,
+                               Footprint const& footprint ) {
+    std::ofstream file( filename.c_str() );
+    if ( !file.is_open() )
+      vw_throw( IOErr() << "Unable to write footprint: " << filename );
+    file << std::setprecision(17);
+    for ( int i = 0; i < 4; i++ )
+      file << footprint.corners[i][0] << " " << footprint.corners[i][1] << "\n";
+  }
+
+  inline Footprint read_footprint( std::string const& filename ) {
+    std::ifstream file( filename.c_str() );
+    if ( !file.is_open() )
+      vw_throw( IOErr() << "Unable to read footprint: " << filename );
+    Footprint footprint;
+    for ( int i = 0; i < 4; i++ )
+      file >> footprint.corners[i][0] >> footprint.corners[i][1];
+    if ( file.fail() )
+      vw_throw( IOErr() << "Invalid footprint file: " << filename );
+    return footprint;
+  }
+
+  // Unit vector for a (latitude, longitude) in degrees
+  inline Vector3 unit_vector( Vector2 const& latlon ) {
+    double lat = latlon[0] * M_PI / 180, lon = latlon[1] * M_PI / 180;
+    return Vector3( cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat) );
+  }
+
+  // Spherical cap that contains the footprint's corners. The radius
+  // is the angle in radians from center to the farthest corner.
+  inline void footprint_cap( Footprint const& footprint,
+                             Vector3& center, double& radius ) {
+    Vector3 corners[4];
+    center = Vector3();
+    for ( int i = 0; i < 4; i++ ) {
+      corners[i] = unit_vector( footprint.corners[i] );
+      center += corners[i];
+    }
+    center = normalize( center );
+    radius = 0;
+    for ( int i = 0; i < 4; i++ )
+      radius = std::max( radius, acos( std::min( 1.0, dot_prod( center, corners[i] ) ) ) );
+  }
+
+  // Convex polygon with fixed storage. Clipping one quadrilateral by
+  // another never produces more than 8 vertices.
+  struct ConvexPolygon {
+    static const int MAX_VERTICES = 16;
+    Vector2 vertices[MAX_VERTICES];
+    int size;
+
+    ConvexPolygon() : size(0) {}
+    inline void push_back( Vector2 const& v ) {
+      if ( size < MAX_VERTICES )
+        vertices[size++] = v;
+    }
+  };
+
+  // Positive for counter clockwise polygons
+  inline double signed_area( ConvexPolygon const& poly ) {
+    double area = 0;
+    for ( int i = 0, j = poly.size - 1; i < poly.size; j = i++ )
+      area += poly.vertices[j][0] * poly.vertices[i][1] -
+        poly.vertices[i][0] * poly.vertices[j][1];
+    return area / 2;
+  }
+
+  // Sutherland-Hodgman clipping of subject by the convex polygon
+  // clip. Either winding is accepted for clip.
+  inline ConvexPolygon clip_convex( ConvexPolygon const& clip,
+                                    ConvexPolygon const& subject ) {
+    double orientation = signed_area( clip ) < 0 ? -1 : 1;
+    ConvexPolygon output = subject, input;
+    double side[ConvexPolygon::MAX_VERTICES];
+    for ( int e = 0; e < clip.size && output.size > 0; e++ ) {
+      Vector2 const& a = clip.vertices[e];
+      Vector2 const& b = clip.vertices[(e+1) % clip.size];
+      double ex = b[0] - a[0], ey = b[1] - a[1];
+
+      input = output;
+      output.size = 0;
+      for ( int i = 0; i < input.size; i++ )
+        side[i] = orientation * ( ex * (input.vertices[i][1] - a[1]) -
+                                  ey * (input.vertices[i][0] - a[0]) );
+
+      for ( int i = 0, prev = input.size - 1; i < input.size; prev = i++ ) {
+        bool inside = side[i] >= 0, prev_inside = side[prev] >= 0;
+        if ( inside != prev_inside ) {
+          double t = side[prev] / ( side[prev] - side[i] );
+          output.push_back( input.vertices[prev] +
+                            t * ( input.vertices[i] - input.vertices[prev] ) );
+        }
+        if ( inside )
+          output.push_back( input.vertices[i] );
+      }
+    }
+    if ( output.size < 3 )
+      output.size = 0;
+    return output;
+  }
+
+  // Area of the spherical triangle abc on the unit sphere
+  inline double spherical_triangle_area( Vector3 const& a, Vector3 const& b,
+                                         Vector3 const& c ) {
+    double numerator = fabs( dot_prod( a, cross_prod( b, c ) ) );
+    double denominator = 1 + dot_prod( a, b ) + dot_prod( b, c ) + dot_prod( c, a );
+    return 2 * atan2( numerator, denominator );
+  }
+
+  // Percent of l's area that is covered by r, measured on the
+  // sphere. Both footprints are projected gnomonically about their
+  // common center, where their great circle edges become straight
+  // lines, and clipped there. The clipped vertices are then taken back
+  // to the sphere to measure area, so the result does not depend on
+  // where the footprints sit in longitude or latitude.
+  inline double percent_overlap( Footprint const& l, Footprint const& r ) {
+    Vector3 l_center, r_center;
+    double l_radius, r_radius;
+    footprint_cap( l, l_center, l_radius );
+    footprint_cap( r, r_center, r_radius );
+    if ( acos( std::max( -1.0, std::min( 1.0, dot_prod( l_center, r_center ) ) ) ) >
+         l_radius + r_radius )
+      return 0;
+
+    // Tangent plane basis at the common center
+    Vector3 center = normalize( l_center + r_center );
+    Vector3 axis = fabs( center[2] ) < 0.9 ? Vector3(0,0,1) : Vector3(1,0,0);
+    Vector3 e1 = normalize( cross_prod( axis, center ) );
+    Vector3 e2 = cross_prod( center, e1 );
+
+    ConvexPolygon l_poly, r_poly;
+    for ( int i = 0; i < 4; i++ ) {
+      Vector3 lv = unit_vector( l.corners[i] ), rv = unit_vector( r.corners[i] );
+      double ld = dot_prod( lv, center ), rd = dot_prod( rv, center );
+      if ( ld < 1e-6 || rd < 1e-6 ) // Not on the projected hemisphere
+        return 0;
+      l_poly.push_back( Vector2( dot_prod( lv, e1 ), dot_prod( lv, e2 ) ) / ld );
+      r_poly.push_back( Vector2( dot_prod( rv, e1 ), dot_prod( rv, e2 ) ) / rd );
+    }
+    ConvexPolygon clipped = clip_convex( l_poly, r_poly );
+
+    // Fan of spherical triangles for each polygon
+    double area[2] = {0, 0};
+    ConvexPolygon const* polys[2] = { &l_poly, &clipped };
+    for ( int p = 0; p < 2; p++ ) {
+      Vector3 vertices[ConvexPolygon::MAX_VERTICES];
+      for ( int i = 0; i < polys[p]->size; i++ )
+        vertices[i] = normalize( center + polys[p]->vertices[i][0] * e1 +
+                                 polys[p]->vertices[i][1] * e2 );
+      for ( int i = 2; i < polys[p]->size; i++ )
+        area[p] += spherical_triangle_area( vertices[0], vertices[i-1], vertices[i] );
+    }
+
+    if ( area[0] == 0 )
+      return 0;
+    return 100 * area[1] / area[0];
+  }
+
+}
+
+#endif//__FOOTPRINT_H__
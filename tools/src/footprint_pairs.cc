@@ -0,0 +1,192 @@
+/// \file footprint_pairs.cc
+///
+/// Writes the list of cube pairs where at least a given percent of
+/// either cube's footprint is covered by the other. Footprints come
+/// from the .footprint sidecars (computed with ISIS when missing).
+/// Candidates are found through a grid over the unit sphere so each
+/// cube is only tested against its neighbors. The output is a job
+/// list for apollo_bulk_match.
+
+#include <vw/Core.h>
+#include <vw/Math.h>
+#include "overlap_check.h"
+
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+namespace po = boost::program_options;
+
+#include <fstream>
+#include <map>
+#include <algorithm>
+
+using namespace vw;
+
+// Bucket grid over unit vectors. A footprint is inserted into every
+// cell its bounding cap's axis aligned box touches.
+class SphereGrid {
+  typedef Vector<int32,3> key_type;
+  struct KeyLess {
+    bool operator()( key_type const& a, key_type const& b ) const {
+      return std::lexicographical_compare( a.begin(), a.end(), b.begin(), b.end() );
+    }
+  };
+  std::map<key_type, std::vector<size_t>, KeyLess> m_cells;
+  double m_cell_size;
+
+  // Range of cells covering the cap. Its chord length bounds how far
+  // the cap reaches from center along any axis.
+  void cells_for( Vector3 const& center, double radius,
+                  key_type& low, key_type& high ) const {
+    double chord = radius >= M_PI ? 2 : 2 * sin( radius / 2 );
+    for ( size_t k = 0; k < 3; k++ ) {
+      low[k]  = int32( floor( (center[k] - chord) / m_cell_size ) );
+      high[k] = int32( floor( (center[k] + chord) / m_cell_size ) );
+    }
+  }
+
+public:
+  SphereGrid( double cell_size ) : m_cell_size( cell_size ) {}
+
+  void insert( size_t index, Vector3 const& center, double radius ) {
+    key_type low, high, key;
+    cells_for( center, radius, low, high );
+    for ( key[0] = low[0]; key[0] <= high[0]; key[0]++ )
+      for ( key[1] = low[1]; key[1] <= high[1]; key[1]++ )
+        for ( key[2] = low[2]; key[2] <= high[2]; key[2]++ )
+          m_cells[key].push_back( index );
+  }
+
+  // Every index sharing a cell with the cap, may contain duplicates
+  void query( Vector3 const& center, double radius,
+              std::vector<size_t>& result ) const {
+    result.clear();
+    key_type low, high, key;
+    cells_for( center, radius, low, high );
+    for ( key[0] = low[0]; key[0] <= high[0]; key[0]++ )
+      for ( key[1] = low[1]; key[1] <= high[1]; key[1]++ )
+        for ( key[2] = low[2]; key[2] <= high[2]; key[2]++ ) {
+          std::map<key_type, std::vector<size_t>, KeyLess>::const_iterator it =
+            m_cells.find( key );
+          if ( it != m_cells.end() )
+            result.insert( result.end(), it->second.begin(), it->second.end() );
+        }
+  }
+};
+
+int main( int argc, char** argv ) {
+  std::vector<std::string> cube_files;
+  std::string cube_list_file, output_file;
+  double req_percent_overlap;
+
+  po::options_description general_options("Options");
+  general_options.add_options()
+    ("cube-list", po::value(&cube_list_file), "A file listing input cube files.")
+    ("overlap,o", po::value(&req_percent_overlap)->default_value(20), "Minimium requirement for image overlap, in percent of the footprint of whichever cube is covered more. The order of the cube list does not matter.")
+    ("output-file", po::value(&output_file)->default_value("image_Match.pair"), "Where to write the pair job list.")
+    ("help,h", "Display this help message");
+
+  po::options_description hidden_options("");
+  hidden_options.add_options()
+    ("cube-files", po::value(&cube_files));
+
+  po::options_description options("Allowed Options");
+  options.add(general_options).add(hidden_options);
+
+  po::positional_options_description p;
+  p.add("cube-files", -1);
+
+  std::ostringstream usage;
+  usage << "Usage: " << argv[0] << " [options] <cube files>...\n";
+  usage << "       " << argv[0] << " [options] --cube-list <list file>\n\n";
+  usage << general_options << std::endl;
+
+  po::variables_map vm;
+  try {
+    po::store( po::command_line_parser( argc, argv ).options(options).positional(p).run(), vm );
+    po::notify( vm );
+  } catch (po::error &e) {
+    std::cout << "An error occured while parsing command line arguments.\n";
+    std::cout << "\t" << e.what() << "\n\n";
+    std::cout << usage.str();
+    return 1;
+  }
+
+  if ( vm.count("help") ) {
+    vw_out() << usage.str();
+    return 1;
+  }
+
+  if ( !cube_list_file.empty() ) {
+    std::ifstream list( cube_list_file.c_str() );
+    if ( !list.is_open() )
+      vw_throw( ArgumentErr() << "Unable to open: " << cube_list_file << "\n" );
+    std::string cube;
+    while ( list >> cube )
+      cube_files.push_back( cube );
+  }
+
+  if ( cube_files.size() < 2 ) {
+    vw_out() << "Error: Must specify at least two input files!\n\n";
+    vw_out() << usage.str();
+    return 1;
+  }
+
+  // Loading footprints
+  size_t num_cubes = cube_files.size();
+  std::vector<Footprint> footprints( num_cubes );
+  std::vector<Vector3> centers( num_cubes );
+  std::vector<double> radii( num_cubes );
+  {
+    TerminalProgressCallback tpc("tools", "Footprints:");
+    double inc_amt = 1.0 / double(num_cubes);
+    for ( size_t i = 0; i < num_cubes; i++ ) {
+      tpc.report_incremental_progress( inc_amt );
+      footprints[i] = load_footprint( cube_files[i] );
+      footprint_cap( footprints[i], centers[i], radii[i] );
+    }
+    tpc.report_finished();
+  }
+
+  // Cells are sized from the median footprint so that typical
+  // frames only touch a handful of cells.
+  std::vector<double> sorted_radii( radii );
+  std::nth_element( sorted_radii.begin(), sorted_radii.begin() + num_cubes / 2,
+                    sorted_radii.end() );
+  double cell_size = std::max( 4 * sin( sorted_radii[num_cubes / 2] / 2 ), 1e-4 );
+  SphereGrid grid( cell_size );
+  for ( size_t i = 0; i < num_cubes; i++ )
+    grid.insert( i, centers[i], radii[i] );
+
+  // Testing every neighbor once
+  std::ofstream output( output_file.c_str() );
+  if ( !output.is_open() )
+    vw_throw( IOErr() << "Unable to write: " << output_file << "\n" );
+  size_t num_candidates = 0, num_pairs = 0;
+  std::vector<size_t> neighbors;
+  std::vector<size_t> last_seen( num_cubes, num_cubes );
+  for ( size_t i = 0; i < num_cubes; i++ ) {
+    grid.query( centers[i], radii[i], neighbors );
+    BOOST_FOREACH( size_t j, neighbors ) {
+      if ( j <= i || last_seen[j] == i )
+        continue;
+      last_seen[j] = i;
+      double angle = acos( std::max( -1.0, std::min( 1.0, dot_prod( centers[i], centers[j] ) ) ) );
+      if ( angle > radii[i] + radii[j] )
+        continue;
+      num_candidates++;
+      // Larger of both directions, so a pair is kept regardless of
+      // which cube comes first in the list
+      double overlap = std::max( percent_overlap( footprints[i], footprints[j] ),
+                                 percent_overlap( footprints[j], footprints[i] ) );
+      if ( overlap >= req_percent_overlap ) {
+        output << cube_files[i] << " " << cube_files[j] << "\n";
+        num_pairs++;
+      }
+    }
+  }
+  output.close();
+
+  vw_out() << "Tested " << num_candidates << " candidates, wrote "
+           << num_pairs << " pairs to " << output_file << "\n";
+  return 0;
+}
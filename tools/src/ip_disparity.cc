@@ -16,9 +16,15 @@ namespace fs = boost::filesystem;
 
 int main(int argc, char** argv) {
   std::string left, right;
+  size_t neighbors;
+  int32 cell_size;
 
   po::options_description general_options("Options");
   general_options.add_options()
+    ("neighbors,k", po::value(&neighbors)->default_value(0),
+     "Krige each cell from only this many nearest matches. Zero uses every match.")
+    ("cell-size", po::value(&cell_size)->default_value(32),
+     "Size in pixels of the cells that share a local kriging solve.")
     ("help,h", "Display this help message");
 
   po::options_description hidden_options("");
@@ -78,15 +84,18 @@ int main(int argc, char** argv) {
   }
   DiskImageView<PixelGray<uint8> > image( right );
   KrigingView<Vector2f> disparity( samples,
-                                   BBox2i(0,0,image.cols(),image.rows()) );
+                                   BBox2i(0,0,image.cols(),image.rows()),
+                                   neighbors, cell_size );
   ImageViewRef<PixelMask<Vector2f> > pdisparity =
     pixel_cast<PixelMask<Vector2f> >( disparity );
-  ImageViewRef<PixelGray<uint8> > right_transformed =
-    transform( image, stereo::DisparityTransform( pdisparity ) );
-
   write_image(prefix+"-D.tif", pdisparity,
               TerminalProgressCallback("tools","Writing:") );
 
+  // Transform with the disparity we just wrote rather than kriging
+  // every pixel a second time through random access.
+  DiskImageView<PixelMask<Vector2f> > disk_disparity( prefix+"-D.tif" );
+  ImageViewRef<PixelGray<uint8> > right_transformed =
+    transform( image, stereo::DisparityTransform( disk_disparity ) );
   write_image( fs::path(right).replace_extension("").string()+"-Trans.tif", right_transformed,
                TerminalProgressCallback("tools","Writing:") );
 
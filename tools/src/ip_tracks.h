@@ -0,0 +1,122 @@
+#ifndef __IP_TRACKS_H__
+#define __IP_TRACKS_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/FundamentalTypes.h>
+#include <boost/unordered_map.hpp>
+
+#include <cmath>
+#include <vector>
+
+namespace vw {
+
+  // Stable identity of an interest point: 16 bits of image id and 24
+  // bits each of x and y quantised to 1/64th of a pixel. Equal floats
+  // always give equal keys, and the key does not depend on the order
+  // the points were read in. Positions must be within +/- 131072 px.
+  inline uint64 ip_key( uint32 image_id, float x, float y ) {
+    static const double QUANTA = 64;
+    static const int64 OFFSET = int64(1) << 23;
+    int64 qx = int64( floor( x * QUANTA + 0.5 ) ) + OFFSET;
+    int64 qy = int64( floor( y * QUANTA + 0.5 ) ) + OFFSET;
+    if ( image_id > 0xFFFF || qx < 0 || qy < 0 ||
+         qx >= 2 * OFFSET || qy >= 2 * OFFSET )
+      vw_throw( ArgumentErr() << "ip_key: image " << image_id << " position "
+                << x << " " << y << " is out of range.\n" );
+    return ( uint64(image_id) << 48 ) | ( uint64(qx) << 24 ) | uint64(qy);
+  }
+  inline uint32 ip_key_image( uint64 key ) { return uint32( key >> 48 ); }
+
+  // Assigns dense ids to keys in the order they are first seen
+  class IPKeyIndex {
+    typedef boost::unordered_map<uint64, uint32> MapType;
+    MapType m_ids;
+    std::vector<uint64> m_keys;
+
+  public:
+    uint32 insert( uint64 key ) {
+      std::pair<MapType::iterator,bool> result =
+        m_ids.insert( std::make_pair( key, uint32(m_keys.size()) ) );
+      if ( result.second )
+        m_keys.push_back( key );
+      return result.first->second;
+    }
+    bool contains( uint64 key ) const { return m_ids.find( key ) != m_ids.end(); }
+    uint64 key( uint32 id ) const { return m_keys[id]; }
+    size_t size() const { return m_keys.size(); }
+  };
+
+  // Union-find whose find and join may be called from many threads at
+  // once. Roots are linked with compare and swap, always below the
+  // smaller id, and paths are halved as they are walked. Only resize
+  // must not overlap with other calls.
+  class UnionFind {
+    std::vector<uint32> m_parent;
+
+  public:
+    UnionFind( size_t size = 0 ) { resize( size ); }
+
+    void resize( size_t size ) {
+      size_t old_size = m_parent.size();
+      m_parent.resize( size );
+      for ( size_t i = old_size; i < size; i++ )
+        m_parent[i] = i;
+    }
+    size_t size() const { return m_parent.size(); }
+
+    uint32 find( uint32 x ) {
+      while ( true ) {
+        uint32 parent = m_parent[x];
+        if ( parent == x )
+          return x;
+        uint32 grandparent = m_parent[parent];
+        if ( parent != grandparent )
+          __sync_bool_compare_and_swap( &m_parent[x], parent, grandparent );
+        x = grandparent;
+      }
+    }
+
+    void join( uint32 a, uint32 b ) {
+      while ( true ) {
+        a = find( a );
+        b = find( b );
+        if ( a == b )
+          return;
+        if ( a < b )
+          std::swap( a, b );
+        if ( __sync_bool_compare_and_swap( &m_parent[a], a, b ) )
+          return;
+      }
+    }
+  };
+
+  // Groups the ids of sets into tracks with a counting sort. Track t
+  // holds members[offsets[t]] up to members[offsets[t+1]], in id
+  // order, and tracks are ordered by their smallest id.
+  inline void group_tracks( UnionFind& sets,
+                            std::vector<uint32>& offsets,
+                            std::vector<uint32>& members ) {
+    size_t size = sets.size();
+    std::vector<uint32> track( size ), root_track( size, uint32(-1) );
+    offsets.assign( 1, 0 );
+    for ( uint32 i = 0; i < size; i++ ) {
+      uint32 root = sets.find( i );
+      if ( root_track[root] == uint32(-1) ) {
+        root_track[root] = offsets.size() - 1;
+        offsets.push_back( 0 );
+      }
+      track[i] = root_track[root];
+      offsets[track[i] + 1]++;
+    }
+    std::vector<uint32>().swap( root_track );
+    for ( size_t t = 0; t + 1 < offsets.size(); t++ )
+      offsets[t+1] += offsets[t];
+    std::vector<uint32> fill( offsets.begin(), offsets.end() - 1 );
+    members.resize( size );
+    for ( uint32 i = 0; i < size; i++ )
+      members[ fill[track[i]]++ ] = i;
+  }
+
+}
+
+#endif//__IP_TRACKS_H__
@@ -2,6 +2,14 @@
 #define __OVERLAP_CHECK_H__
 
 #include <string>
+#include "footprint.h"
+
+// Computes the footprint of a cube by opening it with ISIS
+vw::Footprint compute_footprint( std::string const& cube );
+
+// Returns the footprint saved in the cube's .footprint sidecar. The
+// sidecar is (re)written when it is missing or older than the cube.
+vw::Footprint load_footprint( std::string const& cube );
 
 double percent_overlap( std::string& l_cube,
 			std::string& r_cube );
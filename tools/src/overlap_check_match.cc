@@ -8,12 +8,18 @@
 #include "surf_io.h"
 #include "equalization.h"
 #include "RANSAC_mod.h"
+#include "patch_descriptors.h"
 
 // std header
 #include <stdlib.h>
 #include <iostream>
 #include <vector>
 
+// POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
 // Boost
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
@@ -22,6 +28,9 @@ namespace fs = boost::filesystem;
 
 // Vision Workbench
 #include <vw/Math.h>
+#include <vw/FileIO.h>
+#include <vw/Image.h>
+#include <vw/InterestPoint.h>
 #include <vw/InterestPoint/InterestData.h>
 #include <vw/InterestPoint/Matcher.h>
 using namespace vw;
@@ -56,17 +65,86 @@ static std::string prefix_from_filename(std::string const& filename) {
   return result;
 }
 
+// Holds an flock on a file for as long as it lives. Locks are
+// dropped by the OS if the process dies.
+class FileLock {
+  int m_fd;
+public:
+  FileLock( std::string const& filename, bool block ) : m_fd(-1) {
+    int fd = open( filename.c_str(), O_RDWR | O_CREAT, 0666 );
+    if ( fd < 0 )
+      vw_throw( IOErr() << "Unable to open lock file: " << filename );
+    if ( flock( fd, LOCK_EX | (block ? 0 : LOCK_NB) ) == 0 )
+      m_fd = fd;
+    else
+      close( fd );
+  }
+  ~FileLock() {
+    if ( m_fd >= 0 ) {
+      flock( m_fd, LOCK_UN );
+      close( m_fd );
+    }
+  }
+  bool locked() const { return m_fd >= 0; }
+};
+
+// Detects OBALoG interest points with SGrad descriptors, the same as
+// "ipfind --int obalog --des sgrad", and writes them to vwip_file. At
+// most max_detections of these run at once across every process
+// sharing lock_dir. An image is only ever detected by one of them.
+void find_ip( std::string const& image_file, std::string const& vwip_file,
+              int max_points, double gain, int max_detections,
+              std::string const& lock_dir ) {
+  // Kept in lock_dir so image directories aren't littered with locks
+  FileLock image_lock( lock_dir + "/" + remove_dir_from_filename( vwip_file ) + ".lock", true );
+  if ( fs::exists( vwip_file ) )
+    return; // Someone else finished it while we waited
+
+  boost::shared_ptr<FileLock> slot;
+  while ( !slot ) {
+    for ( int i = 0; i < max_detections && !slot; i++ ) {
+      std::ostringstream slot_file;
+      slot_file << lock_dir << "/ipfind_slot" << i << ".lock";
+      boost::shared_ptr<FileLock> attempt( new FileLock( slot_file.str(), false ) );
+      if ( attempt->locked() )
+        slot = attempt;
+    }
+    if ( !slot )
+      Thread::sleep_ms( 500 );
+  }
+
+  vw_out() << "\t> Detecting IP in " << image_file << "\n";
+  DiskImageView<PixelGray<float> > image( image_file );
+  ip::OBALoGInterestOperator interest_operator( 0.03/gain );
+  ip::IntegralInterestPointDetector<ip::OBALoGInterestOperator>
+    detector( interest_operator, max_points );
+  ip::InterestPointList ip = detect_interest_points( image, detector );
+  describe_sgrad( image, ip );
+
+  // Written next to the final name, then moved in place so readers
+  // never see a partial file.
+  std::string tmp_file = vwip_file + ".tmp";
+  write_binary_ip_file( tmp_file, ip );
+  fs::rename( tmp_file, vwip_file );
+}
+
 int main(int argc, char* argv[]) {
   float req_percent_overlap;
   std::string left_cube;
   std::string right_cube;
-  int max_points;
+  int max_points, grid_size, max_detections;
+  double ip_gain;
+  std::string lock_dir;
 
   // Boost Program Options code
   po::options_description general_options("Options");
   general_options.add_options()
     ("overlap,o",po::value<float>(&req_percent_overlap)->default_value(20),"Minimium requirement for image overlap")
     ("max-pts,m",po::value<int>(&max_points)->default_value(200),"Max points a pair can have, if the number of matches exceeds it will be widdled down by space equalization.")
+    ("gain,g",po::value<double>(&ip_gain)->default_value(1.2),"Gain for interest point detection when a vwip file is missing.")
+    ("max-detections",po::value<int>(&max_detections)->default_value(2),"Interest point detections allowed at once across processes sharing the lock directory.")
+    ("lock-dir",po::value<std::string>(&lock_dir)->default_value("."),"Directory for the detection lock files.")
+    ("grid-size",po::value<int>(&grid_size)->default_value(5),"Equalization divides the matches into a grid of this many cells on a side.")
     ("help,h", "Display this help message");
 
   po::options_description positional_options("Positional Options");
@@ -100,6 +178,11 @@ int main(int argc, char* argv[]) {
     exit(0);
   }
 
+  if ( max_detections < 1 )
+    vw_throw( ArgumentErr() << "--max-detections must be at least 1.\n" );
+  if ( grid_size < 1 )
+    vw_throw( ArgumentErr() << "--grid-size must be at least 1.\n" );
+
   double overlap = percent_overlap( left_cube,
                                     right_cube );
 
@@ -115,17 +198,13 @@ int main(int argc, char* argv[]) {
   std::string right_vwip = prefix_from_filename(right_cube)+".vwip";
   if ( !fs::exists(left_vwip) ) {
     std::cout << " -- > Didn't find left vwip: " << left_vwip << "\n";
-    std::ostringstream cmd;
-    cmd << "ipfind --num 4 --max " << uint(max_points*1.5) << " "
-        << prefix_from_filename(left_cube) << ".tif --int obalog --des sgrad -g 1.2";
-    std::system( cmd.str().c_str() );
+    find_ip( prefix_from_filename(left_cube) + ".tif", left_vwip,
+             uint(max_points*1.5), ip_gain, max_detections, lock_dir );
   }
   if ( !fs::exists(right_vwip) ) {
     std::cout << " -- > Didn't find right vwip: " << right_vwip << "\n";
-    std::ostringstream cmd;
-    cmd << "ipfind --num 4 --max " << uint(max_points*1.5) << " "
-        << prefix_from_filename(right_cube) << ".tif --int obalog --des sgrad -g 1.2";
-    std::system( cmd.str().c_str() );
+    find_ip( prefix_from_filename(right_cube) + ".tif", right_vwip,
+             uint(max_points*1.5), ip_gain, max_detections, lock_dir );
   }
 
   // Loading IP files
@@ -180,7 +259,7 @@ int main(int argc, char* argv[]) {
 
   vw_out() << "Performing equalization\n";
   equalization( matched_ip1,
-                matched_ip2, max_points );
+                matched_ip2, max_points, grid_size, grid_size );
   vw_out() << "\t> Reduced matches to " << matched_ip1.size() << " pairs.\n";
 
   // Finally write the match file
@@ -0,0 +1,101 @@
+#ifndef __PATCH_DESCRIPTORS_H__
+#define __PATCH_DESCRIPTORS_H__
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/Transform.h>
+#include <vw/InterestPoint/InterestData.h>
+#include <vw/InterestPoint/Descriptor.h>
+#include <boost/foreach.hpp>
+
+namespace vw {
+
+  // Computes SGrad descriptors for every interest point that falls in
+  // a subset of the tile buckets. A task owns its own patch and tile
+  // buffers so nothing is allocated per interest point.
+  template <class ViewT>
+  class SGradBucketTask : public Task {
+    ViewT const& m_image;
+    std::vector<std::vector<ip::InterestPoint*> > const& m_buckets;
+    size_t m_start, m_stride;
+
+  public:
+    SGradBucketTask( ViewT const& image,
+                     std::vector<std::vector<ip::InterestPoint*> > const& buckets,
+                     size_t start, size_t stride ) :
+      m_image(image), m_buckets(buckets), m_start(start), m_stride(stride) {}
+
+    virtual ~SGradBucketTask() {}
+    virtual void operator()() {
+      ip::SGradDescriptorGenerator gen;
+      ImageView<PixelGray<float> > patch(42,42);
+      ImageView<typename ViewT::pixel_type> tile;
+      BBox2i image_bbox = bounding_box(m_image);
+
+      for ( size_t b = m_start; b < m_buckets.size(); b += m_stride ) {
+        if ( m_buckets[b].empty() )
+          continue;
+
+        // Everything the patches of this bucket will sample. The extra
+        // pixel covers the bilinear interpolation footprint.
+        BBox2i footprint;
+        BOOST_FOREACH( ip::InterestPoint const* pt, m_buckets[b] ) {
+          float radius = 20.5f * pt->scale + 2;
+          footprint.grow( Vector2i( floor(pt->x - radius), floor(pt->y - radius) ) );
+          footprint.grow( Vector2i( ceil(pt->x + radius) + 1, ceil(pt->y + radius) + 1 ) );
+        }
+        footprint.crop( image_bbox );
+        if ( footprint.empty() )
+          continue;
+        tile = crop( m_image, footprint );
+
+        // Samples outside the tile only happen past the image edge,
+        // where the zero edge extension matches the full image.
+        BOOST_FOREACH( ip::InterestPoint* pt, m_buckets[b] ) {
+          float scaling = 1.0f / pt->scale;
+          patch = transform( tile,
+                             AffineTransform( Matrix2x2( scaling, 0, 0, scaling ),
+                                              Vector2(-scaling*(pt->x-footprint.min().x())+20.5,
+                                                      -scaling*(pt->y-footprint.min().y())+20.5) ),
+                             42, 42 );
+          pt->descriptor.set_size( 180 );
+          gen.compute_descriptor( patch, pt->begin(), pt->end() );
+        }
+      }
+    }
+  };
+
+  // Parallel equivalent of warping a 42x42 patch out of image for each
+  // interest point and handing it to SGradDescriptorGenerator. Points
+  // are bucketed by tile so that each tile is only read once.
+  template <class ViewT>
+  void describe_sgrad( ImageViewBase<ViewT> const& image,
+                       ip::InterestPointList& ip,
+                       int num_threads = vw_settings().default_num_threads(),
+                       int32 tile_size = 1024 ) {
+    ViewT const& view = image.impl();
+    int32 tiles_x = (view.cols() + tile_size - 1) / tile_size;
+    int32 tiles_y = (view.rows() + tile_size - 1) / tile_size;
+    std::vector<std::vector<ip::InterestPoint*> > buckets( tiles_x * tiles_y );
+    BOOST_FOREACH( ip::InterestPoint& pt, ip ) {
+      int32 tx = std::min( std::max( int32(pt.x) / tile_size, 0 ), tiles_x - 1 );
+      int32 ty = std::min( std::max( int32(pt.y) / tile_size, 0 ), tiles_y - 1 );
+      buckets[ tx + ty * tiles_x ].push_back( &pt );
+    }
+
+    if ( num_threads < 1 )
+      num_threads = 1;
+    FifoWorkQueue queue( num_threads );
+    for ( int i = 0; i < num_threads; i++ ) {
+      boost::shared_ptr<Task> task( new SGradBucketTask<ViewT>( view, buckets,
+                                                                i, num_threads ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+  }
+
+}
+
+#endif//__PATCH_DESCRIPTORS_H__